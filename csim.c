@@ -9,189 +9,2430 @@ format laid out by zjs and that is the one thing I wanted to imitate. In my firs
 lines I am laying out everything that will be used in my program which again while
 almost certainly standard protocol, is new to me. *****/
 
+#define _GNU_SOURCE            // madvise, strdup and clock_gettime under -std=c99
 #include "cachelab.h"
+#include "csimlib.h"
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <math.h>
+#include <limits.h>
 
-/***** Valid bit, Tag bits, local LRU counter *****/
+/***** Trace file, mapped if possible, otherwise read through a buffer *****/
+
+#define TRACE_BATCH 4096        // records handed to replay_batch at a time
+#define TRACE_CHUNK (1 << 20)   // read size for pipes and other unmappable input
+
+typedef struct {
+    int fd;
+    char *data;                 // the mapped file or the read buffer
+    size_t len;                 // bytes of data available
+    size_t pos;                 // next byte to parse
+    int mapped;
+    int eof;                    // nothing more to read into the buffer
+    int binary;                 // packed binary records instead of text
+    unsigned long long int prev[2];  // last instruction and data address
+} trace_reader;
+
+/***** Binary traces: a fixed header, then per record one byte with the op
+in the top two bits and the size in the low six (63 means the size follows
+as a varint), then the zigzag varint delta from the previous address of the
+same kind, instruction or data. Header fields are little endian. *****/
+
+#define BIN_MAGIC "CSIMTRC"     // 8 bytes with the terminating 0
+#define BIN_VERSION 1
+#define BIN_HEADER 24           // magic, version, header size, record count
+#define BIN_MAXREC 21           // tag byte and two 10 byte varints
+#define BIN_BIGSIZE 63
+
+/***** Sweep mode: many configurations fed from one pass over the trace.
+The reader fills a ring of batches and every worker thread replays each
+batch into its share of the caches. A single configuration can run set
+parallel on the same ring (-j): worker w owns the sets whose low index bits
+are w, the reader groups each batch by worker and drops those bits from
+the addresses, so every worker replays a cache of S / workers sets. Sets
+never interact under LRU, FIFO, PLRU, LFU or SRRIP, so the counts are the
+serial ones; random and BRRIP draw from one generator per cache. *****/
+
+#define SWEEP_SLOTS 8           // batches in flight between reader and workers
+#define MAX_SWEEP 1024          // configurations in one sweep
+#define MAX_SPLIT 64            // workers of a set-parallel run
+
+typedef struct {
+    int s, E, b;
+    cache c;
+} sweep_config;
+
+typedef struct {
+    trace_record recs[TRACE_BATCH];
+    int n;
+    int pending;                // workers still replaying this batch
+    int start[MAX_SPLIT + 1];   // set parallel: where each worker's records begin
+} sweep_batch;
+
+typedef struct {
+    sweep_batch slots[SWEEP_SLOTS];
+    long produced;              // batches published so far
+    int done;                   // the reader hit the end of the trace
+    int nthreads;
+    sweep_config *configs;
+    int nconfigs;
+    int split;                  // set parallel: log2 of the workers, 0 for a sweep
+    int b;                      // set parallel: block bits of the configuration
+    pthread_mutex_t lock;
+    pthread_cond_t filled;      // a batch was published or the trace ended
+    pthread_cond_t drained;     // a slot was released by the last worker
+} sweep_state;
+
+typedef struct {
+    sweep_state *sweep;
+    int id;
+} sweep_worker;
+
+/***** Hierarchy mode (-H): LRU levels from L1 down, then memory. Each
+level has its own geometry and write policy, the inclusion policy holds
+between every pair of levels. *****/
+
+#define MAX_LEVELS 4
+
+typedef enum {
+    NINE,                       // neither inclusive nor exclusive
+    INCLUSIVE,                  // a lower level eviction invalidates upper copies
+    EXCLUSIVE                   // a block lives in one level, victims move down
+} inclusion_t;
+
+typedef struct {
+    int s, E, b;
+    int write_through;          // writes go on down at once, lines never dirty
+    int no_allocate;            // write misses don't fill the level
+    cache c;                    // hits, misses, evictions and the LRU clock
+    int writebacks;             // dirty lines sent to the next level or memory
+    int back_invalidations;     // lines dropped to keep a lower level inclusive
+} level_t;
+
+/***** Reuse distance mode (-R): the LRU stack distance of every access,
+the number of distinct blocks touched since the last access to the same
+block, found in O(log M) with a Fenwick tree over access times that holds
+a 1 at each block's latest access. Sets are independent under LRU, so a
+curve for 2^s sets keeps one stack per set; s = 0 is fully associative.
+When a set's times run out they are renumbered to their ranks. *****/
+
+#define MAX_CURVES 32
+
+typedef struct {
+    unsigned long long int *keys;   // block addresses, open addressing
+    unsigned int *times;            // latest access time of each key
+    size_t slots;                   // hash slots, a power of 2
+    size_t used;                    // distinct blocks seen
+    unsigned int *tree;             // Fenwick tree over times 1..cap
+    unsigned int cap;
+    unsigned int now;               // next access time
+} reuse_set;
+
+typedef struct {
+    int s;
+    reuse_set *sets;
+    unsigned long long int *hist;   // hist[d], accesses at stack distance d
+    size_t nhist;
+    unsigned long long int cold;    // first accesses to a block
+    unsigned long long int accesses;
+} reuse_curve;
+
+/***** Coherence mode (-C): one private LRU cache of s:E:b per core, kept
+coherent by snooping a shared bus with MESI or MOESI. Cores take turns one
+access at a time, each reading its own trace, or one trace tags every line
+with its core after the size (" L 10,4,1"). A block another core's write
+invalidates is marked lost for the core until its next miss on it, which
+counts as a coherence miss. Per block, the bytes other cores wrote since a
+core lost it tell a true sharing miss from a false sharing one. *****/
+
+#define MAX_CORES 16
+#define TOP_BLOCKS 10           // blocks listed by false sharing misses
+
+typedef enum {
+    STATE_I,
+    STATE_S,
+    STATE_E,
+    STATE_O,                    // MOESI only: dirty, shared, this core answers
+    STATE_M
+} line_state;
+
+typedef enum {
+    MESI,
+    MOESI
+} protocol_t;
+
+typedef struct {
+    cache c;                    // hits, misses, evictions and the LRU clock
+    int coherence_misses;       // misses on lines another core invalidated
+    int invalidations;          // lines this core lost to another core's write
+    int upgrades;               // writes that had to invalidate other copies
+    trace_reader trace;         // one trace per core only
+    trace_record *batch;
+    int n, next;                // records in batch, next one to replay
+} core_t;
+
+typedef struct {
+    unsigned long long int block;   // block address + 1, 0 marks an empty slot
+    unsigned long long int written[MAX_CORES];  // granules others wrote since the core lost it
+    unsigned int lost;              // cores that lost the block and haven't missed on it
+    int invalidations;
+    int coherence_misses;
+    int false_sharing;
+} block_stats;
+
+/***** Attribution (-a, -o): hits, misses and evictions of the plain run
+summed by address region, by set and by the instruction of the last I
+record, each in a hash table keyed by region, set or instruction address.
+Regions are fixed size buckets or the ranges of a map file. The heatmap
+sums by region over windows of the trace, one CSV row per region active
+in a window. Each record is replayed on its own and the cache counters
+diffed, so every policy and layout is attributed the same way. *****/
+
+#define TOP_ROWS 10             // default rows of each -a table
+#define WINDOW 100000           // default accesses per heatmap window
+#define UNMAPPED (~0ULL)        // region key of addresses outside the map
+
+typedef struct {
+    unsigned long long int hits, misses, evictions;
+} attr_count;
+
+typedef struct {
+    unsigned long long int key;
+    attr_count count;
+    int used;
+} attr_entry;
+
+typedef struct {
+    attr_entry *entries;        // open addressing, grown at half full
+    size_t slots;
+    size_t used;
+} attr_table;
+
+typedef struct {
+    unsigned long long int start, end;  // [start, end)
+    char *name;
+} region_t;
+
+/***** Prefetchers (-P), on the plain LRU run. Prefetched lines carry the
+access count at which their data arrives; a demand hit before then is a
+late prefetch, one after a useful one, and a prefetched line evicted before
+any use a useless one. Demand lines a prefetch evicts are remembered in a
+small direct mapped filter, a later miss on one is a pollution miss.
+    next      on a miss or the first use of a prefetch, the next degree blocks
+    stride    per instruction, the last address and stride with a 2 bit
+              confidence, degree strides ahead once the stride repeats
+    stream    STREAMS FIFO buffers of degree blocks beside the cache, one
+              allocated per miss, moved into the cache when used *****/
+
+#define STRIDE_ENTRIES 256      // stride table, direct mapped by instruction
+#define STREAMS 4
+#define MAX_DEGREE 16
+#define PREFETCH_LATENCY 20     // default accesses until prefetched data arrives
+#define POLLUTION_FILTER 4096
+
+typedef enum {
+    PREFETCH_NONE,
+    PREFETCH_NEXT,
+    PREFETCH_STRIDE,
+    PREFETCH_STREAM
+} prefetch_t;
+
+typedef struct {
+    unsigned long long int pc;
+    unsigned long long int last;    // last data address of the instruction
+    long long int stride;
+    int confidence;                 // 0 to 3, prefetching from 2
+} stride_entry;
 
 typedef struct {
-    int valid;
-    unsigned long long int tag;
-    int lru;  
-} cache_line;
+    unsigned long long int blocks[MAX_DEGREE];  // oldest first
+    unsigned long long int ready[MAX_DEGREE];
+    int count;
+    unsigned long long int next;    // next block the stream will fetch
+    unsigned long long int used;    // last allocation or hit, for replacement
+} stream_t;
+
+/***** Set sampling (-m rate) simulates only the sets sample_sets picks,
+about one in rate. Each sampled set's counts are one observation: a total
+is S times their mean, and its 95% interval comes from their spread with
+the finite population correction for the sets drawn. *****/
+
+#define Z95 1.96
+
+/***** TLBs (-T entries:ways, L1 first) in front of the plain run. Each
+level is a csimlib LRU cache whose blocks are pages of the -G size. A data
+record is translated once, down the levels until one hits, filling every
+level that missed. A miss in the last level walks the x86-64 page table,
+one 8 byte entry per level above the page (4 for 4K pages, 3 for 2M, 2 for
+1G), and the walk's loads go into the data cache ahead of the access. The
+tables are laid out linearly from PT_BASE, one PT_SPAN per level, so pages
+next to each other share page table blocks as in a real table. The data
+cache stays virtually indexed. *****/
+
+#define MAX_TLBS 3
+#define PT_BASE 0xffff800000000000ULL
+#define PT_SPAN (1ULL << 40)
+#define VA_BITS 48
+#define MAX_WALK 4
+
+typedef struct {
+    int entries, ways;
+    cache c;
+    unsigned long long int hits, misses;
+} tlb_t;
+
+/*****  Global Variables *****/
+
+cache myCache;
+int s, E, b, hflag = 0, vflag = 0, pflag = 0;
+policy_t policy = POLICY_LRU;   // -r, replacement policy of the caches csim builds
+layout_t layout = LAYOUT_AOS;   // -l, their layout
+char *tracefile;
+level_t levels[MAX_LEVELS];
+int nlevels = 0;
+inclusion_t inclusion = NINE;
+const char *inclusion_names[] = {"nine", "inclusive", "exclusive"};
+unsigned long long int mem_reads = 0, mem_writes = 0;   // blocks moved to and from memory
+core_t cores[MAX_CORES];
+int ncores = 0;
+protocol_t protocol = MESI;
+const char *protocol_names[] = {"mesi", "moesi"};
+unsigned long long int bus_reads = 0, bus_readx = 0, bus_upgrades = 0, bus_writebacks = 0;
+unsigned long long int transfers = 0;   // blocks supplied by another cache instead of memory
+unsigned long long int true_sharing = 0, false_sharing = 0;
+block_stats *blocks = NULL;             // open addressing, grown at half full
+size_t block_slots = 0, block_used = 0;
+int attribution = 0;                    // -a or -o: attribute the plain run
+int bucket_bits = 12;                   // region size without a map
+region_t *regions = NULL;               // sorted by start
+int nregions = 0;
+int top_rows = TOP_ROWS;
+long long int window = WINDOW, window_left = WINDOW, window_index = 0;
+FILE *heatmap = NULL;
+attr_table region_table, set_table, pc_table, window_table;
+unsigned long long int last_pc = 0;     // address of the last I record, 0 before one
+prefetch_t prefetcher = PREFETCH_NONE;
+const char *prefetch_names[] = {"none", "next", "stride", "stream"};
+int prefetch_degree = 0, prefetch_latency = PREFETCH_LATENCY;
+unsigned long long int *pf_ready = NULL;    // per line, arrival of a prefetch not yet used, 0 otherwise
+unsigned long long int pf_clock = 0;        // demand accesses so far
+unsigned long long int pf_issued = 0, pf_useful = 0, pf_late = 0, pf_useless = 0;
+unsigned long long int pf_evictions = 0, pf_pollution = 0;
+unsigned long long int pollution[POLLUTION_FILTER];     // block + 1 of demand lines prefetches evicted
+stride_entry stride_table[STRIDE_ENTRIES];
+stream_t streams[STREAMS];
+int sample_rate = 0;                        // -m, 0 (not given) or 1 simulates every set
+int sampled_sets = 0;
+unsigned long long int sampled_accesses = 0;
+attr_count *set_counts = NULL;              // per set, sampled sets only
+tlb_t tlbs[MAX_TLBS];
+int ntlbs = 0;
+int page_shift = 12;                        // -G, 4k, 2m or 1g pages
+const char *page_name = "4k";
+unsigned long long int walks = 0, walk_refs = 0, walk_hits = 0, walk_misses = 0, walk_evictions = 0;
+
+/***** Core Logic Functions *****/
+
+void print_verbose(const trace_record *recs, int n, const unsigned char *outcomes, int *evicted);
+int check_config(int s, int E, int b);
+
+/***** Cache Hierarchy *****/
+
+int parse_level(char *spec, level_t *level);
+int select_inclusion(const char *name);
+int check_hierarchy(void);
+int level_find(level_t *level, unsigned long long int address);
+int level_insert(level_t *level, unsigned long long int address, int dirty, unsigned long long int *victim, int *victim_dirty);
+int level_remove(level_t *level, unsigned long long int address);
+void hier_read(int k, unsigned long long int address);
+void hier_write(int k, unsigned long long int address, int full);
+void hier_fill(int k, unsigned long long int address, int dirty);
+void hier_exclusive(unsigned long long int address, int write);
+int replay_hierarchy(trace_record *recs, int n);
+void print_hierarchy(void);
+
+/***** Trace Reading *****/
+
+int trace_open(trace_reader *reader, const char *path);
+int trace_read(trace_reader *reader, trace_record *batch, int max);
+void trace_close(trace_reader *reader);
+int parse_record(const char *p, const char *end, trace_record *rec);
+int trace_fill(trace_reader *reader);
+int trace_read_binary(trace_reader *reader, trace_record *batch, int max);
+int get_varint(const unsigned char **p, const unsigned char *end, unsigned long long int *value);
+unsigned char *put_varint(unsigned char *p, unsigned long long int value);
+int convert_trace(const char *in, const char *out);
+void usage(char *name);
+double now_sec(void);
+void print_summary(unsigned long long int hits, unsigned long long int misses, unsigned long long int evictions);
+
+/***** Reuse Distance *****/
+
+void reuse_init(reuse_curve *curve, int s);
+long long int reuse_access(reuse_set *set, unsigned long long int block);
+void reuse_compact(reuse_set *set);
+void reuse_record(reuse_curve *curve, unsigned long long int block);
+int replay_reuse(reuse_curve *curves, int ncurves, trace_record *recs, int n, int b);
+void print_curves(reuse_curve *curves, int ncurves, int b);
+void free_curve(reuse_curve *curve);
+
+/***** Cache Coherence *****/
+
+int select_protocol(const char *name);
+void add_cores(int n);
+int coh_find(int core, unsigned long long int address);
+void coh_fill(int core, unsigned long long int address, line_state state);
+unsigned long long int granules(unsigned long long int address, int size);
+block_stats *block_lookup(unsigned long long int block, int create);
+void coh_miss(int core, unsigned long long int address, int size);
+int coh_snoop(int core, unsigned long long int address, int exclusive);
+void coh_read(int core, unsigned long long int address, int size);
+void coh_write(int core, unsigned long long int address, int size);
+int coh_access(int core, trace_record *rec);
+int run_coherence(char **tracefiles, int ntraces);
+int compare_blocks(const void *a, const void *b);
+void print_coherence(void);
+
+/***** Miss Attribution *****/
+
+int parse_regions(const char *arg);
+int load_regions(const char *path);
+int compare_regions(const void *a, const void *b);
+unsigned long long int region_of(unsigned long long int address);
+const char *region_name(unsigned long long int key, char *buf, size_t len);
+attr_count *attr_lookup(attr_table *table, unsigned long long int key);
+int replay_attributed(cache *myCache, trace_record *recs, int n, int s, int b);
+void flush_window(void);
+void csv_field(FILE *fp, const char *field);
+int compare_entries(const void *a, const void *b);
+attr_entry *sorted_entries(attr_table *table, int (*compare)(const void *, const void *));
+int compare_keys(const void *a, const void *b);
+void print_top(const char *title, attr_table *table, int kind);
+void print_attribution(void);
+void free_table(attr_table *table);
+
+/***** Prefetchers *****/
+
+int parse_prefetcher(char *spec);
+int pf_fill(cache *myCache, search_result result, unsigned long long int ready, unsigned long long int *victim);
+void prefetch(cache *myCache, unsigned long long int block);
+void stride_train(cache *myCache, unsigned long long int address, unsigned long long int pc);
+void stream_refill(stream_t *stream);
+int stream_hit(unsigned long long int block);
+void stream_allocate(unsigned long long int block);
+int pf_access(cache *myCache, unsigned long long int address, unsigned long long int pc, int train);
+int replay_prefetch(cache *myCache, trace_record *recs, int n);
+void print_prefetch(cache *myCache);
+
+/***** Set Sampling *****/
+
+int count_sampled(trace_record *recs, int n, const unsigned char *outcomes);
+void print_sampling(unsigned long long int accesses);
+
+/***** TLBs *****/
+
+int parse_tlb(char *spec, tlb_t *tlb);
+int parse_page(const char *name);
+int translate(unsigned long long int address);
+int replay_tlb(cache *myCache, trace_record *recs, int n);
+void print_tlb(void);
+
+/***** Sweep Mode *****/
+
+int parse_sweep(char *spec, sweep_config *configs, int max);
+int parse_field(char **p, int *values, int max);
+int run_sweep(const char *tracefile, sweep_config *configs, int nconfigs, int nthreads);
+int run_parallel(const char *tracefile, int nthreads);
+long long int sweep_replay(sweep_state *sweep, const char *tracefile);
+int split_batch(sweep_state *sweep, trace_record *recs, int n, sweep_batch *batch);
+void *sweep_thread(void *arg);
+
+/*****  Implementation *****/
+
+/***** The -v lines of a replayed batch. evicted carries across batches:
+once the cache has evicted, every later miss line says eviction. *****/
+
+void print_verbose(const trace_record *recs, int n, const unsigned char *outcomes, int *evicted) {
+    for (int i = 0; i < n; i++) {
+        const trace_record *rec = &recs[i];
+        if (outcomes[i] & ACCESS_SKIPPED)
+            continue;
+        *evicted |= (outcomes[i] & ACCESS_EVICTION) != 0;
+        if (!(outcomes[i] & ACCESS_MISS)) {
+            if (rec->op == MODIFY) {
+                printf("M %llx,%d hit hit\n", rec->address, rec->size);
+            }
+        } else if (rec->op == MODIFY) {
+            printf("M %llx,%d miss", rec->address, rec->size);
+            if (*evicted) {
+                printf(" eviction");
+            }
+            printf(" hit\n");
+        } else {
+            printf("%c %llx,%d miss", rec->op, rec->address, rec->size);
+            if (*evicted) {
+                printf(" eviction");
+            }
+            printf("\n");
+        }
+    }
+}
+
+/***** Returns -1 with a message if csim can't build this cache *****/
+
+int check_config(int s, int E, int b) {
+    const char *problem = check_cache(s, E, b, policy, layout);
+    if (problem) {
+        fprintf(stderr, "Error: %s\n", problem);
+        return -1;
+    }
+    return 0;
+}
+
+/***** Cache Hierarchy: "s:E:b[:wt][:noalloc]" describes one level, write
+back with write allocate unless told otherwise *****/
+
+int parse_level(char *spec, level_t *level) {
+    char *end;
+    memset(level, 0, sizeof(*level));
+    level->s = strtol(spec, &end, 10);
+    if (*end++ != ':')
+        return -1;
+    level->E = strtol(end, &end, 10);
+    if (*end++ != ':')
+        return -1;
+    level->b = strtol(end, &end, 10);
+    while (*end == ':') {
+        char *opt = end + 1;
+        end = opt + strcspn(opt, ":");
+        if (end - opt == 2 && strncmp(opt, "wt", 2) == 0)
+            level->write_through = 1;
+        else if (end - opt == 2 && strncmp(opt, "wb", 2) == 0)
+            level->write_through = 0;
+        else if (end - opt == 7 && strncmp(opt, "noalloc", 7) == 0)
+            level->no_allocate = 1;
+        else if (end - opt == 5 && strncmp(opt, "alloc", 5) == 0)
+            level->no_allocate = 0;
+        else
+            return -1;
+    }
+    return *end == '\0' && level->E > 0 && level->s >= 0 && level->b >= 0 && level->s + level->b < 63 ? 0 : -1;
+}
+
+int select_inclusion(const char *name) {
+    for (int i = 0; i <= EXCLUSIVE; i++)
+        if (strcmp(name, inclusion_names[i]) == 0) {
+            inclusion = i;
+            return 0;
+        }
+    return -1;
+}
+
+/***** Block sizes may only grow going down, so a lower block always holds
+whole upper blocks. Exclusive hierarchies move lines between levels, so
+they need one block size and write back, write allocate levels. *****/
+
+int check_hierarchy(void) {
+    for (int k = 1; k < nlevels; k++)
+        if (levels[k].b < levels[k - 1].b || (inclusion == EXCLUSIVE && levels[k].b != levels[0].b)) {
+            fprintf(stderr, "Error: Block sizes must %s going down the hierarchy\n",
+                    inclusion == EXCLUSIVE ? "all be equal" : "not shrink");
+            return -1;
+        }
+    for (int k = 0; k < nlevels; k++)
+        if (inclusion == EXCLUSIVE && (levels[k].write_through || levels[k].no_allocate)) {
+            fprintf(stderr, "Error: An exclusive hierarchy needs write back, write allocate levels\n");
+            return -1;
+        }
+    return 0;
+}
+
+/***** Way holding address in the level, -1 if it isn't cached *****/
+
+int level_find(level_t *level, unsigned long long int address) {
+    cache_line *lines = level->c.sets[(address >> level->b) & ((1ULL << level->s) - 1)].lines;
+    unsigned long long int tag = address >> (level->s + level->b);
+    for (int i = 0; i < level->E; i++)
+        if (lines[i].valid && lines[i].tag == tag)
+            return i;
+    return -1;
+}
+
+/***** Fill address into the first empty or the LRU way. Returns 1 and the
+victim's block address and dirty bit if a valid line was evicted. *****/
+
+int level_insert(level_t *level, unsigned long long int address, int dirty, unsigned long long int *victim, int *victim_dirty) {
+    int set_index = (address >> level->b) & ((1ULL << level->s) - 1);
+    cache_line *lines = level->c.sets[set_index].lines;
+    int way = 0, evicted;
+
+    for (int i = 0; i < level->E; i++) {
+        if (!lines[i].valid) {
+            way = i;
+            break;
+        }
+        if (lines[i].lru < lines[way].lru)
+            way = i;
+    }
+    if ((evicted = lines[way].valid)) {
+        level->c.evictions++;
+        *victim = (lines[way].tag << (level->s + level->b)) | ((unsigned long long int)set_index << level->b);
+        *victim_dirty = lines[way].dirty;
+    }
+    lines[way].valid = 1;
+    lines[way].dirty = dirty;
+    lines[way].tag = address >> (level->s + level->b);
+    lines[way].lru = level->c.lru_counter++;
+    return evicted;
+}
+
+/***** Drop address from the level, returns its dirty bit or -1 *****/
+
+int level_remove(level_t *level, unsigned long long int address) {
+    int way = level_find(level, address);
+    if (way < 0)
+        return -1;
+    cache_line *line = &level->c.sets[(address >> level->b) & ((1ULL << level->s) - 1)].lines[way];
+    line->valid = 0;
+    return line->dirty;
+}
+
+/***** A read of the block holding address arrives at level k (NINE and
+inclusive). Level nlevels is memory. *****/
+
+void hier_read(int k, unsigned long long int address) {
+    if (k == nlevels) {
+        mem_reads++;
+        return;
+    }
+    level_t *level = &levels[k];
+    int way = level_find(level, address);
+    if (way >= 0) {
+        level->c.hits++;
+        level->c.sets[(address >> level->b) & ((1ULL << level->s) - 1)].lines[way].lru = level->c.lru_counter++;
+        return;
+    }
+    level->c.misses++;
+    hier_read(k + 1, address);
+    hier_fill(k, address, 0);
+}
+
+/***** A write arrives at level k: a store from the CPU, or a write back
+or write through from level k - 1. full is set when the write covers a
+whole block of level k, which can then be allocated without a fetch. *****/
+
+void hier_write(int k, unsigned long long int address, int full) {
+    if (k == nlevels) {
+        mem_writes++;
+        return;
+    }
+    level_t *level = &levels[k];
+    int way = level_find(level, address);
+    int next_full = full && (k + 1 == nlevels || levels[k + 1].b == level->b);
+    if (way >= 0) {
+        cache_line *line = &level->c.sets[(address >> level->b) & ((1ULL << level->s) - 1)].lines[way];
+        level->c.hits++;
+        line->lru = level->c.lru_counter++;
+        if (level->write_through)
+            hier_write(k + 1, address, next_full);
+        else
+            line->dirty = 1;
+        return;
+    }
+    level->c.misses++;
+    if (level->no_allocate) {
+        hier_write(k + 1, address, next_full);
+        return;
+    }
+    if (!full)
+        hier_read(k + 1, address);             // fetch the rest of the block
+    hier_fill(k, address, !level->write_through);
+    if (level->write_through)
+        hier_write(k + 1, address, next_full);
+}
+
+/***** Put a block into level k, writing back a dirty victim and, for an
+inclusive hierarchy, dropping the victim from every level above *****/
+
+void hier_fill(int k, unsigned long long int address, int dirty) {
+    level_t *level = &levels[k];
+    unsigned long long int victim;
+    int victim_dirty;
+
+    if (!level_insert(level, address, dirty, &victim, &victim_dirty))
+        return;
+    if (inclusion == INCLUSIVE) {
+        for (int j = 0; j < k; j++)
+            for (unsigned long long int a = victim; a < victim + (1ULL << level->b); a += 1ULL << levels[j].b) {
+                int upper = level_remove(&levels[j], a);
+                if (upper >= 0) {
+                    levels[j].back_invalidations++;
+                    victim_dirty |= upper;     // the newest data leaves with the victim
+                }
+            }
+    }
+    if (victim_dirty) {
+        level->writebacks++;
+        hier_write(k + 1, victim, k + 1 == nlevels || levels[k + 1].b <= level->b);
+    }
+}
+
+/***** An exclusive hierarchy: a hit below L1 moves the block up to L1,
+and each level's victim moves down one level, dirty ones leaving the last
+level for memory *****/
+
+void hier_exclusive(unsigned long long int address, int write) {
+    level_t *l1 = &levels[0];
+    int way = level_find(l1, address), dirty = 0, k;
+    unsigned long long int victim;
+    int victim_dirty;
+
+    if (way >= 0) {
+        cache_line *line = &l1->c.sets[(address >> l1->b) & ((1ULL << l1->s) - 1)].lines[way];
+        l1->c.hits++;
+        line->lru = l1->c.lru_counter++;
+        line->dirty |= write;
+        return;
+    }
+    l1->c.misses++;
+    for (k = 1; k < nlevels; k++) {
+        if ((dirty = level_remove(&levels[k], address)) >= 0) {
+            levels[k].c.hits++;
+            break;
+        }
+        levels[k].c.misses++;
+    }
+    if (k == nlevels) {
+        mem_reads++;
+        dirty = 0;
+    }
+    if (!level_insert(l1, address, dirty | write, &victim, &victim_dirty))
+        return;
+    for (k = 1; k < nlevels; k++) {
+        if (victim_dirty)
+            levels[k - 1].writebacks++;
+        if (!level_insert(&levels[k], victim, victim_dirty, &victim, &victim_dirty))
+            return;
+    }
+    if (victim_dirty) {
+        levels[nlevels - 1].writebacks++;
+        mem_writes++;
+    }
+}
+
+/***** Replay a batch through the hierarchy, returns the data accesses *****/
+
+int replay_hierarchy(trace_record *recs, int n) {
+    int accesses = 0;
+    for (int i = 0; i < n; i++) {
+        trace_record *rec = &recs[i];
+        if (rec->op == 'I')
+            continue;
+        if (inclusion == EXCLUSIVE) {
+            hier_exclusive(rec->address, rec->op == STORE);
+            if (rec->op == MODIFY)
+                hier_exclusive(rec->address, 1);
+        } else {
+            if (rec->op != STORE)
+                hier_read(0, rec->address);
+            if (rec->op != LOAD)
+                hier_write(0, rec->address, 0);
+        }
+        accesses++;
+    }
+    return accesses;
+}
+
+/***** One summary line per level, then the memory traffic *****/
+
+void print_hierarchy(void) {
+    for (int k = 0; k < nlevels; k++) {
+        level_t *level = &levels[k];
+        printf("L%d hits:%llu misses:%llu evictions:%llu writebacks:%d", k + 1,
+               level->c.hits, level->c.misses, level->c.evictions, level->writebacks);
+        if (inclusion == INCLUSIVE && k < nlevels - 1)
+            printf(" back-invalidations:%d", level->back_invalidations);
+        printf("\n");
+    }
+    unsigned long long int block = 1ULL << levels[nlevels - 1].b;
+    printf("memory reads:%llu writes:%llu bytes:%llu\n", mem_reads, mem_writes, (mem_reads + mem_writes) * block);
+}
+
+/***** Reuse Distance: one empty stack per set *****/
+
+void reuse_init(reuse_curve *curve, int s) {
+    memset(curve, 0, sizeof(*curve));
+    curve->s = s;
+    curve->sets = calloc(1ULL << s, sizeof(reuse_set));
+    for (size_t i = 0; i < 1ULL << s; i++) {
+        reuse_set *set = &curve->sets[i];
+        set->slots = 4;
+        set->keys = malloc(set->slots * sizeof(*set->keys));
+        set->times = malloc(set->slots * sizeof(*set->times));
+        memset(set->keys, 0xff, set->slots * sizeof(*set->keys));   // ~0 marks a free slot
+        set->cap = 4;
+        set->tree = calloc(set->cap + 1, sizeof(*set->tree));
+        set->now = 1;
+    }
+}
+
+/***** Stack distance of an access to block, -1 the first time *****/
+
+long long int reuse_access(reuse_set *set, unsigned long long int block) {
+    size_t slot = (block * 0x9e3779b97f4a7c15ULL) >> 32 & (set->slots - 1);
+    long long int distance = -1;
+    unsigned int t;
+
+    while (set->keys[slot] != ~0ULL && set->keys[slot] != block)
+        slot = (slot + 1) & (set->slots - 1);
+    if (set->now > set->cap) {
+        reuse_compact(set);
+        return reuse_access(set, block);
+    }
+    if (set->keys[slot] == block) {
+        // blocks with a later latest access are the ones above it on the stack
+        unsigned int below = 0;
+        for (t = set->times[slot]; t; t -= t & -t)
+            below += set->tree[t];
+        distance = set->used - below;
+        for (t = set->times[slot]; t <= set->cap; t += t & -t)
+            set->tree[t]--;
+    } else {
+        if (2 * (set->used + 1) > set->slots) {    // grow and rehash
+            size_t old = set->slots;
+            unsigned long long int *keys = set->keys;
+            unsigned int *times = set->times;
+            set->slots *= 2;
+            set->keys = malloc(set->slots * sizeof(*set->keys));
+            set->times = malloc(set->slots * sizeof(*set->times));
+            memset(set->keys, 0xff, set->slots * sizeof(*set->keys));
+            for (size_t i = 0; i < old; i++)
+                if (keys[i] != ~0ULL) {
+                    size_t j = (keys[i] * 0x9e3779b97f4a7c15ULL) >> 32 & (set->slots - 1);
+                    while (set->keys[j] != ~0ULL)
+                        j = (j + 1) & (set->slots - 1);
+                    set->keys[j] = keys[i];
+                    set->times[j] = times[i];
+                }
+            free(keys);
+            free(times);
+            return reuse_access(set, block);
+        }
+        set->keys[slot] = block;
+        set->used++;
+    }
+    set->times[slot] = set->now;
+    for (t = set->now; t <= set->cap; t += t & -t)
+        set->tree[t]++;
+    set->now++;
+    return distance;
+}
+
+/***** Out of times: renumber every block's latest access to its rank,
+doubling the tree if less than half of it would be free afterwards *****/
+
+void reuse_compact(reuse_set *set) {
+    unsigned int t;
+    for (size_t i = 0; i < set->slots; i++)
+        if (set->keys[i] != ~0ULL) {
+            unsigned int rank = 0;
+            for (t = set->times[i]; t; t -= t & -t)
+                rank += set->tree[t];
+            set->times[i] = rank;                  // ranks are 1..used
+        }
+    while (set->cap < 2 * set->used)
+        set->cap *= 2;
+    free(set->tree);
+    set->tree = calloc(set->cap + 1, sizeof(*set->tree));
+    for (t = 1; t <= set->used; t++)           // linear build, a 1 at every rank
+        set->tree[t]++;
+    for (t = 1; t <= set->cap; t++)
+        if (t + (t & -t) <= set->cap)
+            set->tree[t + (t & -t)] += set->tree[t];
+    set->now = set->used + 1;
+}
+
+void reuse_record(reuse_curve *curve, unsigned long long int block) {
+    reuse_set *set = &curve->sets[block & ((1ULL << curve->s) - 1)];
+    long long int d = reuse_access(set, block);
+    curve->accesses++;
+    if (d < 0) {
+        curve->cold++;
+        return;
+    }
+    if ((size_t)d >= curve->nhist) {
+        size_t n = curve->nhist ? curve->nhist : 64;
+        while (n <= (size_t)d)
+            n *= 2;
+        curve->hist = realloc(curve->hist, n * sizeof(*curve->hist));
+        memset(curve->hist + curve->nhist, 0, (n - curve->nhist) * sizeof(*curve->hist));
+        curve->nhist = n;
+    }
+    curve->hist[d]++;
+}
+
+/***** Feed a batch to every curve, M counts as a load and a store *****/
+
+int replay_reuse(reuse_curve *curves, int ncurves, trace_record *recs, int n, int b) {
+    int accesses = 0;
+    for (int i = 0; i < n; i++) {
+        if (recs[i].op == 'I')
+            continue;
+        unsigned long long int block = recs[i].address >> b;
+        for (int c = 0; c < ncurves; c++) {
+            reuse_record(&curves[c], block);
+            if (recs[i].op == MODIFY)
+                reuse_record(&curves[c], block);
+        }
+        accesses++;
+    }
+    return accesses;
+}
+
+/***** CSV miss-ratio curves. A cache of 2^s sets and E ways misses on
+every cold access and every access at distance E or more. E doubles from
+1 until only cold misses are left, or with -v every E where the count
+changes is printed. *****/
+
+void print_curves(reuse_curve *curves, int ncurves, int b) {
+    printf("sets,E,bytes,misses,miss_ratio\n");
+    for (int c = 0; c < ncurves; c++) {
+        reuse_curve *curve = &curves[c];
+        unsigned long long int misses = curve->accesses - curve->cold;  // accesses at distance >= 0
+        unsigned long long int last = ~0ULL;
+        for (size_t ways = 1;; ways = vflag ? ways + 1 : ways * 2) {
+            // misses at E = ways: drop the accesses at distance < ways
+            for (size_t d = vflag ? ways - 1 : ways / 2; d < ways && d < curve->nhist; d++)
+                misses -= curve->hist[d];
+            unsigned long long int total = misses + curve->cold;
+            if (total != last || !vflag)
+                printf("%llu,%zu,%llu,%llu,%.6f\n", 1ULL << curve->s, ways,
+                       (1ULL << curve->s) * ways << b, total, curve->accesses ? (double)total / curve->accesses : 0.0);
+            last = total;
+            if (misses == 0)
+                break;
+        }
+    }
+}
+
+void free_curve(reuse_curve *curve) {
+    for (size_t i = 0; i < 1ULL << curve->s; i++) {
+        free(curve->sets[i].keys);
+        free(curve->sets[i].times);
+        free(curve->sets[i].tree);
+    }
+    free(curve->sets);
+    free(curve->hist);
+}
+
+/***** Cache Coherence: -C by name *****/
+
+int select_protocol(const char *name) {
+    for (int i = 0; i <= MOESI; i++)
+        if (strcmp(name, protocol_names[i]) == 0) {
+            protocol = i;
+            return 0;
+        }
+    return -1;
+}
+
+/***** Give cores ncores .. n - 1 their empty private caches *****/
+
+void add_cores(int n) {
+    for (; ncores < n; ncores++)
+        cores[ncores].c = initialize_cache(s, E, b, POLICY_LRU, LAYOUT_AOS);
+}
+
+/***** Way holding a valid copy of address in the core's cache, -1 if none *****/
+
+int coh_find(int core, unsigned long long int address) {
+    cache_line *lines = cores[core].c.sets[(address >> b) & ((1ULL << s) - 1)].lines;
+    unsigned long long int tag = address >> (s + b);
+    for (int i = 0; i < E; i++)
+        if (lines[i].valid && lines[i].tag == tag)
+            return i;
+    return -1;
+}
+
+/***** Fill address into the core's cache in state, over the first invalid
+or the LRU way. A dirty victim, M or O, is written back over the bus. *****/
+
+void coh_fill(int core, unsigned long long int address, line_state state) {
+    cache *c = &cores[core].c;
+    cache_line *lines = c->sets[(address >> b) & ((1ULL << s) - 1)].lines;
+    int way = 0;
+
+    for (int i = 0; i < E; i++) {
+        if (!lines[i].valid) {
+            way = i;
+            break;
+        }
+        if (lines[i].lru < lines[way].lru)
+            way = i;
+    }
+    if (lines[way].valid) {
+        c->evictions++;
+        if (lines[way].state == STATE_M || lines[way].state == STATE_O) {
+            bus_writebacks++;
+            mem_writes++;
+        }
+    }
+    lines[way].valid = 1;
+    lines[way].state = state;
+    lines[way].tag = address >> (s + b);
+    lines[way].lru = c->lru_counter++;
+}
+
+/***** The parts of its block an access touches as a bit mask, a bit per
+byte for blocks up to 64 bytes, per 64th of the block above that *****/
+
+unsigned long long int granules(unsigned long long int address, int size) {
+    int shift = b > 6 ? b - 6 : 0;
+    unsigned long long int offset = address & ((1ULL << b) - 1);
+    unsigned long long int last = offset + (size > 0 ? size - 1 : 0);
+
+    if (last >> b)
+        last = (1ULL << b) - 1;             // clipped to the block, like the access itself
+    int first = offset >> shift, n = (last >> shift) - first + 1;
+    return n == 64 ? ~0ULL : ((1ULL << n) - 1) << first;
+}
+
+/***** Sharing statistics of a block, added if create is set *****/
+
+block_stats *block_lookup(unsigned long long int block, int create) {
+    size_t slot = 0;
+
+    if (block_slots) {
+        for (slot = (block * 0x9e3779b97f4a7c15ULL) >> 32 & (block_slots - 1); blocks[slot].block;
+             slot = (slot + 1) & (block_slots - 1))
+            if (blocks[slot].block == block + 1)
+                return &blocks[slot];
+    }
+    if (!create)
+        return NULL;
+    if (2 * (block_used + 1) > block_slots) {           // grow and rehash
+        block_stats *old = blocks;
+        size_t old_slots = block_slots;
+        block_slots = block_slots ? 2 * block_slots : 1024;
+        blocks = calloc(block_slots, sizeof(*blocks));
+        for (size_t i = 0; i < old_slots; i++)
+            if (old[i].block) {
+                for (slot = ((old[i].block - 1) * 0x9e3779b97f4a7c15ULL) >> 32 & (block_slots - 1); blocks[slot].block;
+                     slot = (slot + 1) & (block_slots - 1))
+                    ;
+                blocks[slot] = old[i];
+            }
+        free(old);
+        return block_lookup(block, 1);
+    }
+    blocks[slot].block = block + 1;
+    block_used++;
+    return &blocks[slot];
+}
+
+/***** A miss. If the core lost the block to another core's write it is a
+coherence miss, and a false sharing one unless the access touches bytes
+other cores wrote since. *****/
+
+void coh_miss(int core, unsigned long long int address, int size) {
+    block_stats *stats = block_lookup(address >> b, 0);
+
+    cores[core].c.misses++;
+    if (!stats || !(stats->lost >> core & 1))
+        return;
+    stats->lost &= ~(1U << core);
+    stats->coherence_misses++;
+    cores[core].coherence_misses++;
+    if (stats->written[core] & granules(address, size))
+        true_sharing++;
+    else {
+        false_sharing++;
+        stats->false_sharing++;
+    }
+}
+
+/***** Broadcast a read of the block holding address from core, exclusive
+for a write. Other copies are downgraded, or dropped for an exclusive read.
+Returns 2 if a cache owns the block and supplies it, 1 if other caches
+only share it clean, 0 if no other core has it. *****/
+
+int coh_snoop(int core, unsigned long long int address, int exclusive) {
+    int found = 0;
+
+    for (int j = 0; j < ncores; j++) {
+        int way = j == core ? -1 : coh_find(j, address);
+        if (way < 0)
+            continue;
+        cache_line *line = &cores[j].c.sets[(address >> b) & ((1ULL << s) - 1)].lines[way];
+        found = line->state != STATE_S ? 2 : found ? found : 1;
+        if (exclusive) {
+            block_stats *stats = block_lookup(address >> b, 1);
+            line->valid = 0;
+            line->state = STATE_I;
+            stats->invalidations++;
+            stats->lost |= 1U << j;
+            stats->written[j] = 0;
+            cores[j].invalidations++;
+        } else if (line->state == STATE_M && protocol == MESI) {
+            line->state = STATE_S;            // memory takes the data as it goes by
+            mem_writes++;
+        } else if (line->state == STATE_M)
+            line->state = STATE_O;            // the owner keeps answering for it
+        else if (line->state == STATE_E)
+            line->state = STATE_S;
+    }
+    return found;
+}
+
+/***** A load from core *****/
+
+void coh_read(int core, unsigned long long int address, int size) {
+    cache *c = &cores[core].c;
+    int way = coh_find(core, address), found;
+
+    if (way >= 0) {
+        c->hits++;
+        c->sets[(address >> b) & ((1ULL << s) - 1)].lines[way].lru = c->lru_counter++;
+        return;
+    }
+    coh_miss(core, address, size);
+    bus_reads++;
+    if ((found = coh_snoop(core, address, 0)) == 2)
+        transfers++;
+    else
+        mem_reads++;
+    coh_fill(core, address, found ? STATE_S : STATE_E);
+}
+
+/***** A store from core: an S or O copy first invalidates the others, a
+miss reads the block exclusively. Cores that lost the block see the bytes
+written when they miss on it again. *****/
+
+void coh_write(int core, unsigned long long int address, int size) {
+    cache *c = &cores[core].c;
+    int way = coh_find(core, address);
+
+    if (way >= 0) {
+        cache_line *line = &c->sets[(address >> b) & ((1ULL << s) - 1)].lines[way];
+        c->hits++;
+        line->lru = c->lru_counter++;
+        if (line->state == STATE_S || line->state == STATE_O) {
+            bus_upgrades++;
+            cores[core].upgrades++;
+            coh_snoop(core, address, 1);
+        }
+        line->state = STATE_M;
+    } else {
+        coh_miss(core, address, size);
+        bus_readx++;
+        if (coh_snoop(core, address, 1) == 2)
+            transfers++;
+        else
+            mem_reads++;
+        coh_fill(core, address, STATE_M);
+    }
+
+    block_stats *stats = block_lookup(address >> b, 0);
+    if (stats && (stats->lost & ~(1U << core))) {
+        unsigned long long int mask = granules(address, size);
+        for (int j = 0; j < ncores; j++)
+            if (j != core && (stats->lost >> j & 1))
+                stats->written[j] |= mask;
+    }
+}
+
+/***** One record from core, M is a load then a store. Returns 1 for a data
+access, 0 for an I record. *****/
+
+int coh_access(int core, trace_record *rec) {
+    if (rec->op == 'I')
+        return 0;
+    if (rec->op != STORE)
+        coh_read(core, rec->address, rec->size);
+    if (rec->op != LOAD)
+        coh_write(core, rec->address, rec->size);
+    return 1;
+}
+
+/***** Replay a tagged trace in file order, or one trace per core with the
+cores taking turns one data access at a time until every trace ends *****/
+
+int run_coherence(char **tracefiles, int ntraces) {
+    unsigned long long int accesses = 0;
+    double start = now_sec();
+    int n;
+
+    if (ntraces == 1) {
+        static trace_record batch[TRACE_BATCH];
+        trace_reader trace;
+        if (trace_open(&trace, tracefiles[0]) < 0) {
+            fprintf(stderr, "Error: Couldn't open %s for reading.\n", tracefiles[0]);
+            return -1;
+        }
+        while ((n = trace_read(&trace, batch, TRACE_BATCH)) > 0)
+            for (int i = 0; i < n; i++) {
+                if (batch[i].core >= MAX_CORES) {
+                    fprintf(stderr, "Error: Core %d in %s, at most %d cores\n", batch[i].core, tracefiles[0], MAX_CORES);
+                    return -1;
+                }
+                add_cores(batch[i].core + 1);
+                accesses += coh_access(batch[i].core, &batch[i]);
+            }
+        trace_close(&trace);
+    } else {
+        add_cores(ntraces);
+        for (int k = 0; k < ntraces; k++) {
+            if (trace_open(&cores[k].trace, tracefiles[k]) < 0) {
+                fprintf(stderr, "Error: Couldn't open %s for reading.\n", tracefiles[k]);
+                return -1;
+            }
+            cores[k].batch = malloc(TRACE_BATCH * sizeof(trace_record));
+        }
+        for (int active = ntraces; active > 0;) {
+            active = 0;
+            for (int k = 0; k < ntraces; k++) {
+                core_t *cpu = &cores[k];
+                while (cpu->batch) {
+                    if (cpu->next == cpu->n) {
+                        cpu->next = 0;
+                        if ((cpu->n = trace_read(&cpu->trace, cpu->batch, TRACE_BATCH)) == 0) {
+                            trace_close(&cpu->trace);      // this core is done
+                            free(cpu->batch);
+                            cpu->batch = NULL;
+                            break;
+                        }
+                    }
+                    if (coh_access(k, &cpu->batch[cpu->next++])) {
+                        accesses++;
+                        break;
+                    }
+                }
+                active += cpu->batch != NULL;
+            }
+        }
+    }
+    if (pflag) {
+        double secs = now_sec() - start;
+        fprintf(stderr, "%llu accesses in %.3fs, %.2f million accesses/s\n", accesses, secs, accesses / secs / 1e6);
+    }
+    return 0;
+}
+
+/***** Most false sharing misses first, then most coherence misses *****/
+
+int compare_blocks(const void *a, const void *b) {
+    const block_stats *x = *(block_stats * const *)a, *y = *(block_stats * const *)b;
+    if (x->false_sharing != y->false_sharing)
+        return y->false_sharing - x->false_sharing;
+    if (x->coherence_misses != y->coherence_misses)
+        return y->coherence_misses - x->coherence_misses;
+    return (x->block > y->block) - (x->block < y->block);
+}
+
+/***** One line per core, the bus and memory traffic, the sharing misses
+and the blocks with the most false sharing *****/
+
+void print_coherence(void) {
+    for (int k = 0; k < ncores; k++) {
+        core_t *cpu = &cores[k];
+        printf("core%d hits:%llu misses:%llu evictions:%llu coherence-misses:%d invalidations:%d upgrades:%d\n", k,
+               cpu->c.hits, cpu->c.misses, cpu->c.evictions, cpu->coherence_misses, cpu->invalidations, cpu->upgrades);
+    }
+    printf("bus reads:%llu read-exclusives:%llu upgrades:%llu writebacks:%llu transactions:%llu cache-to-cache:%llu\n",
+           bus_reads, bus_readx, bus_upgrades, bus_writebacks, bus_reads + bus_readx + bus_upgrades + bus_writebacks, transfers);
+    printf("memory reads:%llu writes:%llu bytes:%llu\n", mem_reads, mem_writes, (mem_reads + mem_writes) << b);
+    printf("sharing misses true:%llu false:%llu\n", true_sharing, false_sharing);
+
+    block_stats **top = malloc((block_used + 1) * sizeof(*top));
+    size_t n = 0;
+    for (size_t i = 0; i < block_slots; i++)
+        if (blocks[i].block && blocks[i].false_sharing)
+            top[n++] = &blocks[i];
+    qsort(top, n, sizeof(*top), compare_blocks);
+    for (size_t i = 0; i < n && i < TOP_BLOCKS; i++)
+        printf("block 0x%llx invalidations:%d coherence-misses:%d false-sharing:%d\n", (top[i]->block - 1) << b,
+               top[i]->invalidations, top[i]->coherence_misses, top[i]->false_sharing);
+    free(top);
+}
+
+/***** Miss Attribution: -a takes the bits of a bucket or a map file *****/
+
+int parse_regions(const char *arg) {
+    char *end;
+    long bits = strtol(arg, &end, 10);
+
+    if (*arg && *end == '\0') {
+        if (bits < 0 || bits > 63)
+            return -1;
+        bucket_bits = bits;
+        return 0;
+    }
+    return load_regions(arg);
+}
+
+/***** One region per line, "start size name" in hex, or "start size type
+name" as nm -S prints it. Lines without a size are skipped. Regions should
+not overlap. *****/
+
+int load_regions(const char *path) {
+    FILE *fp = fopen(path, "r");
+    char line[1024];
+    int cap = 0;
+
+    if (!fp)
+        return -1;
+    while (fgets(line, sizeof(line), fp)) {
+        char *p = line, *end;
+        unsigned long long int start = strtoull(p, &end, 16), size;
+        if (end == p || line[0] == '#')
+            continue;
+        size = strtoull(p = end, &end, 16);
+        if (end == p || size == 0)
+            continue;
+        for (p = end; *p == ' ' || *p == '\t'; p++)
+            ;
+        if (p[0] && (p[1] == ' ' || p[1] == '\t'))    // nm's symbol type
+            for (p += 2; *p == ' ' || *p == '\t'; p++)
+                ;
+        p[strcspn(p, "\r\n")] = '\0';
+        if (!*p)
+            continue;
+        if (nregions == cap)
+            regions = realloc(regions, (cap = cap ? 2 * cap : 64) * sizeof(*regions));
+        regions[nregions].start = start;
+        regions[nregions].end = start + size;
+        regions[nregions].name = strdup(p);
+        nregions++;
+    }
+    fclose(fp);
+    qsort(regions, nregions, sizeof(*regions), compare_regions);
+    return nregions > 0 ? 0 : -1;
+}
+
+int compare_regions(const void *a, const void *b) {
+    const region_t *x = a, *y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/***** Region key of an address: its bucket, or the index of the map
+region holding it, UNMAPPED if none does *****/
+
+unsigned long long int region_of(unsigned long long int address) {
+    int lo = 0, hi = nregions;
+
+    if (!regions)
+        return address >> bucket_bits;
+    while (lo < hi) {                       // first region starting above address
+        int mid = (lo + hi) / 2;
+        if (regions[mid].start <= address)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 && address < regions[lo - 1].end ? (unsigned long long int)lo - 1 : UNMAPPED;
+}
+
+const char *region_name(unsigned long long int key, char *buf, size_t len) {
+    if (regions)
+        return key == UNMAPPED ? "(unmapped)" : regions[key].name;
+    snprintf(buf, len, "0x%llx", key << bucket_bits);
+    return buf;
+}
+
+/***** Counts of key in the table, zeroed on first use *****/
+
+attr_count *attr_lookup(attr_table *table, unsigned long long int key) {
+    if (2 * (table->used + 1) > table->slots) {         // grow and rehash
+        attr_table old = *table;
+        table->slots = old.slots ? 2 * old.slots : 256;
+        table->entries = calloc(table->slots, sizeof(attr_entry));
+        table->used = 0;
+        for (size_t i = 0; i < old.slots; i++)
+            if (old.entries[i].used)
+                *attr_lookup(table, old.entries[i].key) = old.entries[i].count;
+        free(old.entries);
+    }
+    size_t slot = (key * 0x9e3779b97f4a7c15ULL) >> 32 & (table->slots - 1);
+    while (table->entries[slot].used && table->entries[slot].key != key)
+        slot = (slot + 1) & (table->slots - 1);
+    if (!table->entries[slot].used) {
+        table->entries[slot].used = 1;
+        table->entries[slot].key = key;
+        table->used++;
+    }
+    return &table->entries[slot].count;
+}
+
+/***** Replay records one at a time and charge what each access did to its
+region, set and instruction. Returns the data accesses like replay_batch. *****/
+
+int replay_attributed(cache *myCache, trace_record *recs, int n, int s, int b) {
+    int accesses = 0;
+
+    for (int i = 0; i < n; i++) {
+        unsigned long long int address = recs[i].address;
+        if (recs[i].op == 'I') {
+            last_pc = address;
+            continue;
+        }
+        unsigned long long int hits = myCache->hits, misses = myCache->misses, evictions = myCache->evictions;
+        unsigned char outcome;
+        accesses += replay_batch(myCache, &recs[i], 1, &outcome);
+        if (vflag) {
+            int evicted = myCache->evictions > 0;
+            print_verbose(&recs[i], 1, &outcome, &evicted);
+        }
+        hits = myCache->hits - hits;
+        misses = myCache->misses - misses;
+        evictions = myCache->evictions - evictions;
+
+        unsigned long long int region = region_of(address);
+        attr_count *counts[4] = {
+            attr_lookup(&region_table, region),
+            attr_lookup(&set_table, (address >> b) & ((1ULL << s) - 1)),
+            attr_lookup(&pc_table, last_pc),
+            heatmap ? attr_lookup(&window_table, region) : NULL
+        };
+        for (int k = 0; k < 4 && counts[k]; k++) {
+            counts[k]->hits += hits;
+            counts[k]->misses += misses;
+            counts[k]->evictions += evictions;
+        }
+        if (heatmap && --window_left == 0)
+            flush_window();
+    }
+    return accesses;
+}
+
+/***** Heatmap rows of the window that just ended, by region *****/
+
+void flush_window(void) {
+    attr_entry *rows = sorted_entries(&window_table, compare_keys);
+    char buf[32];
+
+    for (size_t i = 0; i < window_table.used; i++) {
+        fprintf(heatmap, "%lld,%lld,", window_index, window_index * window);
+        csv_field(heatmap, region_name(rows[i].key, buf, sizeof(buf)));
+        fprintf(heatmap, ",%llu,%llu,%llu\n", rows[i].count.hits, rows[i].count.misses, rows[i].count.evictions);
+    }
+    free(rows);
+    memset(window_table.entries, 0, window_table.slots * sizeof(attr_entry));
+    window_table.used = 0;
+    window_index++;
+    window_left = window;
+}
+
+/***** Quoted if it holds a comma or a quote, map names are free text *****/
+
+void csv_field(FILE *fp, const char *field) {
+    if (!strpbrk(field, ",\"\n")) {
+        fputs(field, fp);
+        return;
+    }
+    fputc('"', fp);
+    for (; *field; field++) {
+        if (*field == '"')
+            fputc('"', fp);
+        fputc(*field, fp);
+    }
+    fputc('"', fp);
+}
+
+/***** Most misses first, then most evictions, then by key *****/
+
+int compare_entries(const void *a, const void *b) {
+    const attr_entry *x = a, *y = b;
+    if (x->count.misses != y->count.misses)
+        return x->count.misses < y->count.misses ? 1 : -1;
+    if (x->count.evictions != y->count.evictions)
+        return x->count.evictions < y->count.evictions ? 1 : -1;
+    return compare_keys(a, b);
+}
+
+int compare_keys(const void *a, const void *b) {
+    const attr_entry *x = a, *y = b;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+/***** The used entries of a table, sorted, for the caller to free *****/
 
-typedef struct {
-    cache_line* lines;
-} cache_set;
+attr_entry *sorted_entries(attr_table *table, int (*compare)(const void *, const void *)) {
+    attr_entry *rows = malloc((table->used + 1) * sizeof(*rows));
+    size_t n = 0;
 
-typedef struct {
-    cache_set* sets;
-} cache;
+    for (size_t i = 0; i < table->slots; i++)
+        if (table->entries[i].used)
+            rows[n++] = table->entries[i];
+    qsort(rows, n, sizeof(*rows), compare);
+    return rows;
+}
 
-typedef enum {
-    LOAD = 'L',
-    STORE = 'S',
-    MODIFY = 'M'
-} operation_t;
+/***** The top_rows entries of a table by misses. kind is 0 for regions, 1
+for sets, 2 for instructions. *****/
 
-typedef struct {
-    int hit_line;
-    int empty_line;
-    int LRU_line;
-    int set_index;               
-    unsigned long long int tag;   
-} search_result;
+void print_top(const char *title, attr_table *table, int kind) {
+    static const char *labels[] = {"region", "set", "instruction"};
+    attr_entry *rows = sorted_entries(table, compare_entries);
+    char buf[32];
 
-/*****  Global Variables *****/
+    printf("\ntop %s by misses\n", title);
+    printf("%-32s %12s %12s %12s %10s\n", labels[kind], "hits", "misses", "evictions", "miss-ratio");
+    for (size_t i = 0; i < table->used && i < (size_t)top_rows; i++) {
+        attr_count *count = &rows[i].count;
+        const char *name = buf;
+        if (kind == 0)
+            name = region_name(rows[i].key, buf, sizeof(buf));
+        else if (kind == 1)
+            snprintf(buf, sizeof(buf), "%llu", rows[i].key);
+        else if (rows[i].key)
+            snprintf(buf, sizeof(buf), "0x%llx", rows[i].key);
+        else
+            name = "(none)";                // data accesses before the first I record
+        unsigned long long int total = count->hits + count->misses;
+        printf("%-32s %12llu %12llu %12llu %10.4f\n", name, count->hits, count->misses, count->evictions,
+               total ? (double)count->misses / total : 0.0);
+    }
+    free(rows);
+}
 
-cache myCache;
-int hit_count = 0;
-int miss_count = 0;
-int eviction_count = 0;
-unsigned long long int LRU_counter = 0;  // global LRU counter
-int s, E, b, hflag = 0, vflag = 0;
-char *tracefile;
+/***** The three tables after the summary, and the last partial window *****/
 
-/***** Helper Functions *****/
+void print_attribution(void) {
+    print_top("regions", &region_table, 0);
+    print_top("sets", &set_table, 1);
+    print_top("instructions", &pc_table, 2);
+    if (heatmap) {
+        if (window_left < window)
+            flush_window();
+        fclose(heatmap);
+    }
+}
 
-search_result search_in_cache(cache *myCache, unsigned long long int address, int s, int b, int E);
-void handle_hit(cache_set *set, int hit_line);
-void handle_miss(cache_set *set, unsigned long long int tag, search_result result);
+void free_table(attr_table *table) {
+    free(table->entries);
+    memset(table, 0, sizeof(*table));
+}
 
-/***** Core Logic Functions *****/
+/***** Prefetchers: "name[:degree[:latency]]" for -P *****/
 
-void process_cache(cache *myCache, operation_t op, unsigned long long int address, int size, int s, int E, int b);
-cache initialize_cache(int S, int E);
-void free_cache(cache *myCache, int S, int E);
+int parse_prefetcher(char *spec) {
+    char *end = spec + strcspn(spec, ":");
+    int found = 0;
 
-/*****  Implementation *****/
+    for (int i = PREFETCH_NEXT; i <= PREFETCH_STREAM; i++)
+        if ((size_t)(end - spec) == strlen(prefetch_names[i]) && strncmp(spec, prefetch_names[i], end - spec) == 0) {
+            prefetcher = i;
+            found = 1;
+        }
+    if (!found)
+        return -1;
+    prefetch_degree = prefetcher == PREFETCH_STREAM ? 4 : 1;
+    if (*end == ':')
+        prefetch_degree = strtol(end + 1, &end, 10);
+    if (*end == ':')
+        prefetch_latency = strtol(end + 1, &end, 10);
+    return *end == '\0' && prefetch_degree > 0 && prefetch_degree <= MAX_DEGREE && prefetch_latency >= 0 ? 0 : -1;
+}
 
-search_result search_in_cache(cache *myCache, unsigned long long int address, int s, int b, int E) {
-    int S = 1 << s;
-    int set_index; 
-    unsigned long long int tag;  
-
-    set_index = (address >> b) & (S - 1);
-    tag = address >> (s + b);
-    
-    cache_set *set = &myCache->sets[set_index];
-    
-    search_result result = {-1, -1, 0};
-    for (int i = 0; i < E; i++) {
-        if (set->lines[i].valid && set->lines[i].tag == tag) {
-            result.hit_line = i;
+/***** Fill the way search_in_cache picked, arriving at ready (0 for demand
+data). Returns 1 and the victim's block if a demand line was evicted, 2 if
+an unused prefetch was, 0 if the way was empty. *****/
+
+int pf_fill(cache *myCache, search_result result, unsigned long long int ready, unsigned long long int *victim) {
+    int way = result.empty_line != -1 ? result.empty_line : result.LRU_line;
+    cache_line *line = &myCache->sets[result.set_index].lines[way];
+    size_t index = (size_t)result.set_index * E + way;
+    int evicted = 0;
+
+    if (result.empty_line == -1) {
+        myCache->evictions++;
+        *victim = line->tag << s | result.set_index;
+        evicted = pf_ready[index] ? 2 : 1;
+        pf_useless += evicted == 2;
+    }
+    line->valid = 1;
+    line->tag = result.tag;
+    line->lru = myCache->lru_counter++;
+    pf_ready[index] = ready;
+    return evicted;
+}
+
+/***** Bring block into the cache unless it is there already *****/
+
+void prefetch(cache *myCache, unsigned long long int block) {
+    search_result result = search_in_cache(myCache, block << b);
+    unsigned long long int victim;
+
+    if (result.hit_line != -1)
+        return;
+    pf_issued++;
+    if (pf_fill(myCache, result, pf_clock + prefetch_latency, &victim) == 1) {
+        pf_evictions++;
+        pollution[victim & (POLLUTION_FILTER - 1)] = victim + 1;
+    }
+}
+
+/***** Stride: learn the stride of the instruction, prefetch ahead of it
+once the same stride was seen twice in a row *****/
+
+void stride_train(cache *myCache, unsigned long long int address, unsigned long long int pc) {
+    stride_entry *entry = &stride_table[(pc ^ pc >> 8) & (STRIDE_ENTRIES - 1)];
+
+    if (entry->pc != pc) {
+        entry->pc = pc;
+        entry->last = address;
+        entry->stride = 0;
+        entry->confidence = 0;
+        return;
+    }
+    long long int delta = address - entry->last;
+    entry->last = address;
+    if (delta == entry->stride) {
+        if (entry->confidence < 3)
+            entry->confidence++;
+    } else if (entry->confidence > 0)
+        entry->confidence--;
+    else
+        entry->stride = delta;
+    if (entry->confidence < 2 || entry->stride == 0)
+        return;
+    for (int k = 1; k <= prefetch_degree; k++) {
+        unsigned long long int block = (address + k * entry->stride) >> b;
+        if (block != address >> b)
+            prefetch(myCache, block);
+    }
+}
+
+/***** Stream buffers: keep a stream degree blocks ahead *****/
+
+void stream_refill(stream_t *stream) {
+    while (stream->count < prefetch_degree) {
+        stream->blocks[stream->count] = stream->next++;
+        stream->ready[stream->count++] = pf_clock + prefetch_latency;
+        pf_issued++;
+    }
+}
+
+/***** A miss looks in every buffer. The blocks ahead of a match are
+dropped unused, the match moves to the cache. Returns 1 on a match. *****/
+
+int stream_hit(unsigned long long int block) {
+    for (int k = 0; k < STREAMS; k++) {
+        stream_t *stream = &streams[k];
+        for (int i = 0; i < stream->count; i++)
+            if (stream->blocks[i] == block) {
+                pf_useless += i;
+                pf_useful++;
+                pf_late += pf_clock < stream->ready[i];
+                stream->count -= i + 1;
+                memmove(stream->blocks, stream->blocks + i + 1, stream->count * sizeof(*stream->blocks));
+                memmove(stream->ready, stream->ready + i + 1, stream->count * sizeof(*stream->ready));
+                stream->used = pf_clock;
+                stream_refill(stream);
+                return 1;
+            }
+    }
+    return 0;
+}
+
+/***** A miss no buffer had restarts the least recently used buffer *****/
+
+void stream_allocate(unsigned long long int block) {
+    stream_t *stream = &streams[0];
+
+    for (int k = 1; k < STREAMS; k++)
+        if (streams[k].used < stream->used)
+            stream = &streams[k];
+    pf_useless += stream->count;
+    stream->count = 0;
+    stream->next = block + 1;
+    stream->used = pf_clock;
+    stream_refill(stream);
+}
+
+/***** One demand access with the prefetcher running, returns 1 on a hit.
+A miss a stream buffer covers counts as a hit. The prefetcher only sees
+accesses with train set, so the store half of an M record does not show
+the stride table a delta of zero. *****/
+
+int pf_access(cache *myCache, unsigned long long int address, unsigned long long int pc, int train) {
+    search_result result = search_in_cache(myCache, address);
+    unsigned long long int block = address >> b, victim;
+    int hit = result.hit_line != -1, trigger = !hit;
+
+    pf_clock++;
+    if (hit) {
+        size_t index = (size_t)result.set_index * E + result.hit_line;
+        handle_hit(myCache, result);
+        if (pf_ready[index]) {
+            pf_useful++;
+            pf_late += pf_clock < pf_ready[index];
+            pf_ready[index] = 0;
+            trigger = 1;                    // the first use of a prefetch runs ahead again
+        }
+    } else {
+        unsigned long long int *filter = &pollution[block & (POLLUTION_FILTER - 1)];
+        if (*filter == block + 1) {
+            pf_pollution++;
+            *filter = 0;
+        }
+        hit = prefetcher == PREFETCH_STREAM && stream_hit(block);
+        if (hit)
+            myCache->hits++;
+        else
+            myCache->misses++;
+        pf_fill(myCache, result, 0, &victim);
+    }
+
+    switch (train ? prefetcher : PREFETCH_NONE) {
+        case PREFETCH_NEXT:
+            for (int k = 1; trigger && k <= prefetch_degree; k++)
+                prefetch(myCache, block + k);
             break;
+        case PREFETCH_STRIDE:
+            stride_train(myCache, address, pc);
+            break;
+        case PREFETCH_STREAM:
+            if (!hit)
+                stream_allocate(block);
+            break;
+        default:
+            break;
+    }
+    return hit;
+}
+
+/***** Replay a batch with the prefetcher, returns the data accesses *****/
+
+int replay_prefetch(cache *myCache, trace_record *recs, int n) {
+    int accesses = 0;
+
+    for (int i = 0; i < n; i++) {
+        trace_record *rec = &recs[i];
+        if (rec->op == 'I') {
+            last_pc = rec->address;
+            continue;
         }
-        if (!set->lines[i].valid && result.empty_line == -1) {
-            result.empty_line = i;
+        unsigned char outcome = pf_access(myCache, rec->address, last_pc, 1) ? ACCESS_HIT : ACCESS_MISS;
+        if (vflag) {
+            int evicted = myCache->evictions > 0;
+            print_verbose(rec, 1, &outcome, &evicted);
         }
-        if (set->lines[i].lru < set->lines[result.LRU_line].lru) {
-            result.LRU_line = i;
+        if (rec->op == MODIFY)
+            pf_access(myCache, rec->address, last_pc, 0);
+        accesses++;
+    }
+    return accesses;
+}
+
+/***** The prefetch counts after the summary *****/
+
+void print_prefetch(cache *myCache) {
+    printf("prefetch %s degree:%d latency:%d issued:%llu useful:%llu late:%llu useless:%llu\n",
+           prefetch_names[prefetcher], prefetch_degree, prefetch_latency, pf_issued, pf_useful, pf_late, pf_useless);
+    printf("prefetch accuracy:%.4f coverage:%.4f pollution-evictions:%llu pollution-misses:%llu\n",
+           pf_issued ? (double)pf_useful / pf_issued : 0.0,
+           pf_useful + myCache->misses ? (double)pf_useful / (pf_useful + myCache->misses) : 0.0,
+           pf_evictions, pf_pollution);
+}
+
+/***** Set Sampling: charge each simulated record to its set, returns the
+data records seen, simulated or not *****/
+
+int count_sampled(trace_record *recs, int n, const unsigned char *outcomes) {
+    int accesses = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (recs[i].op == 'I')
+            continue;
+        accesses++;
+        if (outcomes[i] & ACCESS_SKIPPED)
+            continue;
+        attr_count *count = &set_counts[(recs[i].address >> b) & ((1ULL << s) - 1)];
+        sampled_accesses++;
+        count->hits += !(outcomes[i] & ACCESS_MISS) + (recs[i].op == MODIFY);
+        count->misses += (outcomes[i] & ACCESS_MISS) != 0;
+        count->evictions += (outcomes[i] & ACCESS_EVICTION) != 0;
+    }
+    return accesses;
+}
+
+/***** The extrapolated summary, then what was sampled and the intervals *****/
+
+void print_sampling(unsigned long long int accesses) {
+    int S = 1 << s, k = sampled_sets;
+    double sum[3] = {0}, squares[3] = {0}, estimate[3], interval[3];
+
+    for (int set = 0; set < S; set++) {
+        if (!myCache.sample[set])
+            continue;
+        double x[3] = {set_counts[set].hits, set_counts[set].misses, set_counts[set].evictions};
+        for (int f = 0; f < 3; f++) {
+            sum[f] += x[f];
+            squares[f] += x[f] * x[f];
         }
     }
+    for (int f = 0; f < 3; f++) {
+        double mean = sum[f] / k;
+        double variance = k > 1 ? (squares[f] - k * mean * mean) / (k - 1) : 0;
+        estimate[f] = S * mean;
+        interval[f] = k > 1 ? Z95 * S * sqrt((1.0 - (double)k / S) * (variance > 0 ? variance : 0) / k) : -1;
+    }
+
+    print_summary(estimate[0] + 0.5, estimate[1] + 0.5, estimate[2] + 0.5);
+    printf("sampled sets:%d/%d accesses:%llu/%llu\n", k, S, sampled_accesses, accesses);
+    if (k > 1)
+        printf("estimate hits:%.0f+-%.0f misses:%.0f+-%.0f evictions:%.0f+-%.0f (95%% confidence)\n",
+               estimate[0], interval[0], estimate[1], interval[1], estimate[2], interval[2]);
+    else
+        printf("estimate hits:%.0f misses:%.0f evictions:%.0f (one set, no interval)\n",
+               estimate[0], estimate[1], estimate[2]);
+}
+
+/***** TLBs: "entries:ways" for -T, a power of 2 number of sets *****/
 
-    result.set_index = set_index;
-    result.tag = tag;
- 
-    return result;
+int parse_tlb(char *spec, tlb_t *tlb) {
+    char *end;
+
+    tlb->entries = strtol(spec, &end, 10);
+    if (*end != ':')
+        return -1;
+    tlb->ways = strtol(end + 1, &end, 10);
+    if (*end != '\0' || tlb->ways <= 0 || tlb->entries < tlb->ways || tlb->entries % tlb->ways)
+        return -1;
+    int sets = tlb->entries / tlb->ways;
+    return sets & (sets - 1) ? -1 : 0;
 }
 
-/***** Result Processing Logic ******/
+/***** Page size for -G, sets page_shift and page_name *****/
+
+int parse_page(const char *name) {
+    static const char *names[] = {"4k", "2m", "1g"};
+    static const int shifts[] = {12, 21, 30};
 
-void handle_hit(cache_set *set, int hit_line) {
-    set->lines[hit_line].lru = LRU_counter++;
-    hit_count++;
+    for (int i = 0; i < 3; i++)
+        if (strcmp(name, names[i]) == 0) {
+            page_shift = shifts[i];
+            page_name = names[i];
+            return 0;
+        }
+    return -1;
 }
 
-void handle_miss(cache_set *set, unsigned long long int tag, search_result result) {
-    int line_to_fill = (result.empty_line != -1) ? result.empty_line : result.LRU_line;
+/***** Look address up in every TLB level it misses in, filling them.
+Returns 1 if the last level missed too and the page table must be walked. *****/
 
-    if (result.empty_line == -1) {
-        eviction_count++;
+int translate(unsigned long long int address) {
+    for (int k = 0; k < ntlbs; k++) {
+        search_result result = search_in_cache(&tlbs[k].c, address);
+        if (result.hit_line != -1) {
+            handle_hit(&tlbs[k].c, result);
+            tlbs[k].hits++;
+            return 0;
+        }
+        handle_miss(&tlbs[k].c, result);
+        tlbs[k].misses++;
+    }
+    return 1;
+}
+
+/***** Replay a batch with the walks of its TLB misses put in front of the
+accesses that caused them, returns the data accesses *****/
+
+int replay_tlb(cache *myCache, trace_record *recs, int n) {
+    static trace_record walked[TRACE_BATCH * (MAX_WALK + 1)];
+    static unsigned char is_walk[TRACE_BATCH * (MAX_WALK + 1)], outcomes[TRACE_BATCH * (MAX_WALK + 1)];
+    int m = 0, accesses = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (recs[i].op == 'I')
+            continue;
+        unsigned long long int address = recs[i].address & ((1ULL << VA_BITS) - 1);
+        if (translate(address)) {
+            walks++;
+            for (int level = 0, shift = 39; shift >= page_shift; level++, shift -= 9) {
+                walked[m] = (trace_record){LOAD, 0, 8, PT_BASE + level * PT_SPAN + (address >> shift) * 8};
+                is_walk[m++] = 1;
+            }
+        }
+        walked[m] = recs[i];
+        is_walk[m++] = 0;
+        accesses++;
+    }
+    replay_batch(myCache, walked, m, outcomes);
+    for (int i = 0; i < m; i++) {
+        if (!is_walk[i])
+            continue;
+        walk_refs++;
+        walk_hits += !(outcomes[i] & ACCESS_MISS);
+        walk_misses += (outcomes[i] & ACCESS_MISS) != 0;
+        walk_evictions += (outcomes[i] & ACCESS_EVICTION) != 0;
+    }
+    return accesses;
+}
+
+/***** One line per TLB level, then the page walks and their share of the
+data cache's traffic *****/
+
+void print_tlb(void) {
+    unsigned long long int accesses = myCache.hits + myCache.misses;
+
+    for (int k = 0; k < ntlbs; k++) {
+        tlb_t *tlb = &tlbs[k];
+        printf("tlb L%d entries:%d ways:%d page:%s hits:%llu misses:%llu hit-rate:%.4f\n", k + 1,
+               tlb->entries, tlb->ways, page_name, tlb->hits, tlb->misses,
+               tlb->hits + tlb->misses ? (double)tlb->hits / (tlb->hits + tlb->misses) : 0.0);
     }
+    printf("page walks:%llu references:%llu cache-hits:%llu cache-misses:%llu cache-evictions:%llu\n",
+           walks, walk_refs, walk_hits, walk_misses, walk_evictions);
+    printf("page walk share of cache accesses:%.4f misses:%.4f\n",
+           accesses ? (double)walk_refs / accesses : 0.0,
+           myCache.misses ? (double)walk_misses / myCache.misses : 0.0);
+}
+
+/***** Trace Reading: the trace is mapped whole, or read in large chunks
+when it is a pipe, and parsed by hand into batches of records. "-" reads
+standard input. *****/
 
-    set->lines[line_to_fill].valid = 1;
-    set->lines[line_to_fill].tag = tag;
-    set->lines[line_to_fill].lru = LRU_counter++;
-    miss_count++;
+int trace_open(trace_reader *reader, const char *path) {
+    struct stat st;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (reader->fd < 0)
+        return -1;
+    if (fstat(reader->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        reader->data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+        if (reader->data != MAP_FAILED) {
+            madvise(reader->data, st.st_size, MADV_SEQUENTIAL);
+            reader->len = st.st_size;
+            reader->mapped = reader->eof = 1;
+        }
+    }
+    if (!reader->mapped && (reader->data = malloc(TRACE_CHUNK)) == NULL)
+        return -1;
+    while (!reader->eof && reader->len < BIN_HEADER)
+        trace_fill(reader);
+    // binary traces start with the magic, anything else is parsed as text
+    if (reader->len >= BIN_HEADER && memcmp(reader->data, BIN_MAGIC, sizeof(BIN_MAGIC)) == 0) {
+        unsigned char *h = (unsigned char *)reader->data;
+        int version = h[8] | h[9] << 8 | h[10] << 16 | h[11] << 24;
+        size_t header = h[12] | h[13] << 8 | h[14] << 16 | (size_t)h[15] << 24;
+        if (version != BIN_VERSION || header < BIN_HEADER || header > reader->len) {
+            fprintf(stderr, "Error: %s is an unsupported binary trace version.\n", path);
+            exit(EXIT_FAILURE);
+        }
+        reader->binary = 1;
+        reader->pos = header;
+    }
+    return 0;
 }
 
-/***** Process optional vflag output as well as mandatory handle_hit and handle_miss *****/
+/***** Move the unparsed bytes to the front of the buffer and read more
+behind them. Returns the bytes read, 0 once the input is exhausted. *****/
 
-void process_cache(cache *myCache, operation_t op, unsigned long long int address, int size, int s, int E, int b) {
-    search_result result = search_in_cache(myCache, address, s, b, E);
+int trace_fill(trace_reader *reader) {
+    size_t left = reader->len - reader->pos;
+    ssize_t got = 0;
 
-    if (result.hit_line != -1) {
-        handle_hit(&myCache->sets[result.set_index], result.hit_line);
+    if (reader->eof)
+        return 0;
+    memmove(reader->data, reader->data + reader->pos, left);
+    reader->len = left;
+    reader->pos = 0;
+    if (left == TRACE_CHUNK || (got = read(reader->fd, reader->data + left, TRACE_CHUNK - left)) <= 0)
+        reader->eof = 1;               // lines longer than a chunk are cut off
+    else
+        reader->len += got;
+    return got > 0 ? got : 0;
+}
 
-        if (vflag) {
-            if (op == MODIFY) {
-                printf("M %llx,%d hit hit\n", address, size);
+/***** Fill batch with up to max records, returns how many, 0 at the end *****/
+
+int trace_read(trace_reader *reader, trace_record *batch, int max) {
+    int n = 0;
+
+    if (reader->binary)
+        return trace_read_binary(reader, batch, max);
+    while (n < max) {
+        char *line = reader->data + reader->pos;
+        char *nl = memchr(line, '\n', reader->len - reader->pos);
+        if (!nl) {
+            if (reader->eof) {                 // last line without a newline
+                if (reader->pos < reader->len && parse_record(line, reader->data + reader->len, &batch[n]))
+                    n++;
+                reader->pos = reader->len;
+                break;
             }
+            trace_fill(reader);                // keep the partial line, read more behind it
+            continue;
         }
-    } else {
-        handle_miss(&myCache->sets[result.set_index], result.tag, result);
+        if (parse_record(line, nl, &batch[n]))
+            n++;
+        reader->pos = nl + 1 - reader->data;
+    }
+    return n;
+}
 
-        if (vflag) {
-            if (op == MODIFY) {
-                printf("M %llx,%d miss", address, size);
-                if (eviction_count > 0) {
-                    printf(" eviction");
-                }
-                printf(" hit\n");
-            } else {
-                printf("%c %llx,%d miss", op, address, size);
-                if (eviction_count > 0) {
-                    printf(" eviction");
-                }
-                printf("\n");
+/***** Decode binary records, same contract as trace_read *****/
+
+int trace_read_binary(trace_reader *reader, trace_record *batch, int max) {
+    static const char ops[4] = {'I', LOAD, STORE, MODIFY};
+    unsigned long long int delta, size;
+    int n = 0;
+
+    while (n < max) {
+        if (reader->len - reader->pos < BIN_MAXREC && trace_fill(reader) > 0)
+            continue;
+        const unsigned char *p = (unsigned char *)reader->data + reader->pos;
+        const unsigned char *end = (unsigned char *)reader->data + reader->len;
+        if (p == end)
+            break;
+        unsigned char tag = *p++;
+        int kind = (tag >> 6) != 0;               // instruction or data address
+        if (!get_varint(&p, end, &delta))
+            break;                                // truncated last record
+        size = tag & BIN_BIGSIZE;
+        if (size == BIN_BIGSIZE && !get_varint(&p, end, &size))
+            break;
+        reader->prev[kind] += (delta >> 1) ^ -(delta & 1);
+        batch[n].op = ops[tag >> 6];
+        batch[n].core = 0;
+        batch[n].size = size;
+        batch[n].address = reader->prev[kind];
+        reader->pos = (char *)p - reader->data;
+        n++;
+    }
+    if (n < max)
+        reader->pos = reader->len;
+    return n;
+}
+
+int get_varint(const unsigned char **p, const unsigned char *end, unsigned long long int *value) {
+    unsigned long long int v = 0;
+    for (int shift = 0; *p < end && shift < 64; shift += 7) {
+        unsigned char c = *(*p)++;
+        v |= (unsigned long long int)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            *value = v;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+unsigned char *put_varint(unsigned char *p, unsigned long long int value) {
+    while (value >= 0x80) {
+        *p++ = value | 0x80;
+        value >>= 7;
+    }
+    *p++ = value;
+    return p;
+}
+
+void trace_close(trace_reader *reader) {
+    if (reader->mapped)
+        munmap(reader->data, reader->len);
+    else
+        free(reader->data);
+    if (reader->fd != STDIN_FILENO)
+        close(reader->fd);
+}
+
+/***** " op hexaddr,size" with no scanf, returns 0 for a blank or bad line *****/
+
+int parse_record(const char *p, const char *end, trace_record *rec) {
+    unsigned long long int address = 0;
+    int size = 0, digits = 0;
+
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    if (p == end)
+        return 0;
+    rec->op = *p++;
+    while (p < end && *p == ' ')
+        p++;
+    for (; p < end; p++, digits++) {
+        unsigned c = *p;
+        if (c - '0' < 10)
+            address = address << 4 | (c - '0');
+        else if ((c | 0x20) - 'a' < 6)
+            address = address << 4 | ((c | 0x20) - 'a' + 10);
+        else
+            break;
+    }
+    if (!digits || p == end || *p++ != ',')
+        return 0;
+    for (; p < end && (unsigned)(*p - '0') < 10; p++)
+        size = size * 10 + (*p - '0');
+    rec->address = address;
+    rec->size = size;
+    rec->core = 0;
+    if (p < end && *p == ',') {             // the core of a tagged trace
+        int core = 0;
+        for (p++; p < end && (unsigned)(*p - '0') < 10 && core < 256; p++)
+            core = core * 10 + (*p - '0');
+        rec->core = core < 256 ? core : 255;
+    }
+    return 1;
+}
+
+/***** Convert a trace (text or binary) to the binary format, "-" writes
+to stdout. The record count in the header is filled in when out can be
+seeked, it is 0 otherwise. *****/
+
+int convert_trace(const char *in, const char *out) {
+    static trace_record batch[TRACE_BATCH];
+    static unsigned char buf[TRACE_BATCH * BIN_MAXREC];
+    unsigned char header[BIN_HEADER] = BIN_MAGIC;
+    unsigned long long int prev[2] = {0, 0}, records = 0, bytes = BIN_HEADER;
+    trace_reader trace;
+    int n;
+
+    if (trace_open(&trace, in) < 0) {
+        fprintf(stderr, "Error: Couldn't open %s for reading.\n", in);
+        return -1;
+    }
+    FILE *fp = strcmp(out, "-") == 0 ? stdout : fopen(out, "wb");
+    if (!fp) {
+        fprintf(stderr, "Error: Couldn't open %s for writing.\n", out);
+        trace_close(&trace);
+        return -1;
+    }
+    header[8] = BIN_VERSION;
+    header[12] = BIN_HEADER;
+    fwrite(header, 1, BIN_HEADER, fp);
+
+    while ((n = trace_read(&trace, batch, TRACE_BATCH)) > 0) {
+        unsigned char *p = buf;
+        for (int i = 0; i < n; i++) {
+            if (batch[i].core) {
+                fprintf(stderr, "Error: Binary traces don't keep core tags, convert one trace per core.\n");
+                fclose(fp);
+                trace_close(&trace);
+                return -1;
+            }
+            int op = batch[i].op == LOAD ? 1 : batch[i].op == STORE ? 2 : batch[i].op == MODIFY ? 3 : 0;
+            int big = (unsigned)batch[i].size >= BIN_BIGSIZE;
+            long long int delta = batch[i].address - prev[op != 0];
+            prev[op != 0] = batch[i].address;
+            *p++ = op << 6 | (big ? BIN_BIGSIZE : batch[i].size);
+            p = put_varint(p, ((unsigned long long int)delta << 1) ^ (delta >> 63));
+            if (big)
+                p = put_varint(p, (unsigned)batch[i].size);
+        }
+        fwrite(buf, 1, p - buf, fp);
+        records += n;
+        bytes += p - buf;
+    }
+    if (fp != stdout && fseek(fp, 16, SEEK_SET) == 0)
+        for (int i = 0; i < 8; i++)
+            fputc(records >> (8 * i) & 0xff, fp);
+    size_t insize = trace.len;
+    trace_close(&trace);
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Error: Couldn't write %s.\n", out);
+        return -1;
+    }
+    fprintf(stderr, "%llu records, %llu bytes", records, bytes);
+    if (trace.mapped)
+        fprintf(stderr, " from %zu (%.1f%%)", insize, 100.0 * bytes / insize);
+    fprintf(stderr, "\n");
+    return 0;
+}
+
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/***** printSummary takes ints, the cache counts are 64 bit. Counts past
+INT_MAX are clamped there, with the real ones in a warning. *****/
+
+void print_summary(unsigned long long int hits, unsigned long long int misses, unsigned long long int evictions) {
+    if (hits > INT_MAX || misses > INT_MAX || evictions > INT_MAX)
+        fprintf(stderr, "Warning: hits:%llu misses:%llu evictions:%llu clamped to %d for the summary\n",
+                hits, misses, evictions, INT_MAX);
+    printSummary(hits > INT_MAX ? INT_MAX : (int)hits, misses > INT_MAX ? INT_MAX : (int)misses,
+                 evictions > INT_MAX ? INT_MAX : (int)evictions);
+}
+
+/***** Sweep Mode: parse "s:E:b", each field a comma separated list of
+numbers and lo-hi ranges, into the cross product of configurations.
+Returns how many were added, -1 if the spec is bad or too large. *****/
+
+int parse_sweep(char *spec, sweep_config *configs, int max) {
+    int sv[64], ev[64], bv[64], ns, ne, nb, n = 0;
+    char *p = spec;
+
+    if ((ns = parse_field(&p, sv, 64)) <= 0 || *p++ != ':' ||
+        (ne = parse_field(&p, ev, 64)) <= 0 || *p++ != ':' ||
+        (nb = parse_field(&p, bv, 64)) <= 0 || *p != '\0')
+        return -1;
+    for (int i = 0; i < ns; i++)
+        for (int j = 0; j < ne; j++)
+            for (int k = 0; k < nb; k++) {
+                if (n == max || sv[i] + bv[k] > 62 || ev[j] < 1)
+                    return -1;
+                configs[n].s = sv[i];
+                configs[n].E = ev[j];
+                configs[n].b = bv[k];
+                n++;
             }
+    return n;
+}
+
+int parse_field(char **p, int *values, int max) {
+    int n = 0;
+    while (1) {
+        char *end;
+        long lo = strtol(*p, &end, 10), hi = lo;
+        if (end == *p || lo < 0)
+            return -1;
+        if (*end == '-') {
+            *p = end + 1;
+            hi = strtol(*p, &end, 10);
+            if (end == *p || hi < lo)
+                return -1;
         }
+        for (long v = lo; v <= hi; v++) {
+            if (n == max)
+                return -1;
+            values[n++] = v;
+        }
+        *p = end;
+        if (**p != ',')
+            return n;
+        (*p)++;
+    }
+}
+
+/***** Read the trace once and replay it into every configuration, sharded
+round robin over nthreads workers. Prints one CSV line per configuration
+in the order given. *****/
+
+int run_sweep(const char *tracefile, sweep_config *configs, int nconfigs, int nthreads) {
+    static sweep_state sweep;
+
+    for (int i = 0; i < nconfigs; i++)
+        if (check_config(configs[i].s, configs[i].E, configs[i].b) < 0)
+            return -1;
+    for (int i = 0; i < nconfigs; i++)
+        configs[i].c = initialize_cache(configs[i].s, configs[i].E, configs[i].b, policy, layout);
+    sweep.configs = configs;
+    sweep.nconfigs = nconfigs;
+    sweep.nthreads = nthreads;
+
+    double start = now_sec();
+    long long int records = sweep_replay(&sweep, tracefile);
+    if (records < 0)
+        return -1;
+    if (pflag) {
+        double secs = now_sec() - start;
+        fprintf(stderr, "%lld records x %d configurations in %.3fs, %.2f million accesses/s\n",
+                records, nconfigs, secs, records * nconfigs / secs / 1e6);
+    }
+
+    printf("s,E,b,hits,misses,evictions\n");
+    for (int i = 0; i < nconfigs; i++) {
+        sweep_config *cfg = &configs[i];
+        printf("%d,%d,%d,%llu,%llu,%llu\n", cfg->s, cfg->E, cfg->b, cfg->c.hits, cfg->c.misses, cfg->c.evictions);
+        free_cache(&cfg->c);
     }
+    return 0;
 }
 
-/***** Memory allocation and Cache Initialization*/
+/***** The -s -E -b cache split by sets over nthreads workers, rounded down
+to a power of 2 no larger than the number of sets. Prints the summary like
+the serial run. *****/
+
+int run_parallel(const char *tracefile, int nthreads) {
+    static sweep_state sweep;
+    static sweep_config configs[MAX_SPLIT];
+    int split = 0;
+
+    while (split < s && 2 << split <= nthreads && 2 << split <= MAX_SPLIT)
+        split++;
+    for (int w = 0; w < 1 << split; w++) {
+        configs[w].s = s - split;
+        configs[w].E = E;
+        configs[w].b = b;
+        configs[w].c = initialize_cache(configs[w].s, E, b, policy, layout);
+    }
+    sweep.configs = configs;
+    sweep.nconfigs = sweep.nthreads = 1 << split;
+    sweep.split = split;
+    sweep.b = b;
+
+    double start = now_sec();
+    long long int accesses = sweep_replay(&sweep, tracefile);
+    if (accesses < 0)
+        return -1;
+    if (pflag) {
+        double secs = now_sec() - start;
+        fprintf(stderr, "%lld accesses in %.3fs, %.2f million accesses/s (%s, %d threads)\n",
+                accesses, secs, accesses / secs / 1e6, configs[0].c.layout_name, 1 << split);
+    }
+    for (int w = 0; w < 1 << split; w++) {
+        myCache.hits += configs[w].c.hits;
+        myCache.misses += configs[w].c.misses;
+        myCache.evictions += configs[w].c.evictions;
+        free_cache(&configs[w].c);
+    }
+    print_summary(myCache.hits, myCache.misses, myCache.evictions);
+    return 0;
+}
 
-cache initialize_cache(int S, int E) {
-    cache newCache;
+/***** Start the workers, publish the whole trace to them a batch at a
+time, and wait for them. Returns the records published, -1 if the trace
+can't be opened. *****/
 
-    // Allocate memory for the sets
-    newCache.sets = (cache_set*) malloc(S * sizeof(cache_set));
+long long int sweep_replay(sweep_state *sweep, const char *tracefile) {
+    static trace_record staging[TRACE_BATCH];
+    sweep_worker workers[sweep->nthreads];
+    pthread_t threads[sweep->nthreads];
+    trace_reader trace;
 
-    // Allocate a contiguous block of memory for all cache lines of all sets
-    cache_line* allLines = (cache_line*) malloc(S * E * sizeof(cache_line));
+    if (trace_open(&trace, tracefile) < 0) {
+        fprintf(stderr, "Error: Couldn't open %s for reading.\n", tracefile);
+        return -1;
+    }
+    pthread_mutex_init(&sweep->lock, NULL);
+    pthread_cond_init(&sweep->filled, NULL);
+    pthread_cond_init(&sweep->drained, NULL);
+    for (int i = 0; i < sweep->nthreads; i++) {
+        workers[i].sweep = sweep;
+        workers[i].id = i;
+        pthread_create(&threads[i], NULL, sweep_thread, &workers[i]);
+    }
 
-    // Initialize every cache line to default values and assign pointers to appropriate sections
-    for (int i = 0; i < S; i++) {
-        newCache.sets[i].lines = allLines + (i * E); // Point to the appropriate section in the contiguous block
-        for (int j = 0; j < E; j++) {
-            newCache.sets[i].lines[j].valid = 0;
-            newCache.sets[i].lines[j].tag = 0;
-            newCache.sets[i].lines[j].lru = 0;
+    long long int records = 0;
+    for (long seq = 0;; seq++) {
+        sweep_batch *batch = &sweep->slots[seq % SWEEP_SLOTS];
+        pthread_mutex_lock(&sweep->lock);
+        while (batch->pending > 0)                 // wait for every worker to finish with the slot
+            pthread_cond_wait(&sweep->drained, &sweep->lock);
+        pthread_mutex_unlock(&sweep->lock);
+        int n = trace_read(&trace, sweep->split ? staging : batch->recs, TRACE_BATCH);
+        if (n > 0)
+            batch->n = sweep->split ? split_batch(sweep, staging, n, batch) : n;
+        pthread_mutex_lock(&sweep->lock);
+        if (n > 0) {
+            batch->pending = sweep->nthreads;
+            sweep->produced++;
+        } else {
+            sweep->done = 1;
         }
+        pthread_cond_broadcast(&sweep->filled);
+        pthread_mutex_unlock(&sweep->lock);
+        if (n == 0)
+            break;
+        records += batch->n;
     }
+    for (int i = 0; i < sweep->nthreads; i++)
+        pthread_join(threads[i], NULL);
+    trace_close(&trace);
+    return records;
+}
+
+/***** Set parallel: counting sort the data records of a batch by worker,
+with the worker's bits cut out of each set index. Returns the records
+kept. *****/
 
-    return newCache;
+int split_batch(sweep_state *sweep, trace_record *recs, int n, sweep_batch *batch) {
+    int split = sweep->split, b = sweep->b, mask = (1 << split) - 1;
+    int *next = batch->start;
+
+    memset(next, 0, sizeof(batch->start));
+    for (int i = 0; i < n; i++)
+        if (recs[i].op != 'I')
+            next[((recs[i].address >> b) & mask) + 1]++;
+    for (int w = 0; w < mask; w++)
+        next[w + 1] += next[w];
+    for (int i = 0; i < n; i++) {
+        if (recs[i].op == 'I')
+            continue;
+        unsigned long long int address = recs[i].address;
+        trace_record *rec = &batch->recs[next[(address >> b) & mask]++];
+        *rec = recs[i];
+        rec->address = (address >> (b + split)) << b | (address & ((1ULL << b) - 1));
+    }
+    // next[w] now holds where worker w + 1 begins, shift it back
+    memmove(next + 1, next, (mask + 1) * sizeof(*next));
+    next[0] = 0;
+    return next[mask + 1];
 }
 
+/***** Worker: replay every published batch into configurations id,
+id + nthreads, ... then release the slot *****/
+
+void *sweep_thread(void *arg) {
+    sweep_worker *worker = arg;
+    sweep_state *sweep = worker->sweep;
+
+    for (long seq = 0;; seq++) {
+        pthread_mutex_lock(&sweep->lock);
+        while (seq >= sweep->produced && !sweep->done)
+            pthread_cond_wait(&sweep->filled, &sweep->lock);
+        int more = seq < sweep->produced;
+        pthread_mutex_unlock(&sweep->lock);
+        if (!more)
+            break;
 
-/***** Free memory allocated for cache *****/
+        sweep_batch *batch = &sweep->slots[seq % SWEEP_SLOTS];
+        for (int c = worker->id; c < sweep->nconfigs; c += sweep->nthreads) {
+            sweep_config *cfg = &sweep->configs[c];
+            if (sweep->split)                 // only the worker's own sets
+                replay_batch(&cfg->c, batch->recs + batch->start[c], batch->start[c + 1] - batch->start[c], NULL);
+            else
+                replay_batch(&cfg->c, batch->recs, batch->n, NULL);
+        }
 
-void free_cache(cache *myCache, int S, int E) {
-    free(myCache->sets[0].lines);  // free the entire block of cache lines
-    free(myCache->sets);  // free the sets
+        pthread_mutex_lock(&sweep->lock);
+        if (--batch->pending == 0)
+            pthread_cond_signal(&sweep->drained);
+        pthread_mutex_unlock(&sweep->lock);
+    }
+    return NULL;
 }
 
 /***** Command Line Parsing *****/
 
+/***** Usage lines, shared by every error path *****/
+
+void usage(char *name) {
+    fprintf(stderr, "Usage: %s [-hvp] [-j <threads>] [-l <layout>] [-r <policy>] -s <s> -E <E> -b <b> -t <tracefile>\n", name);
+    fprintf(stderr, "       %s [-vp] -P <prefetcher> -s <s> -E <E> -b <b> -t <tracefile>\n", name);
+    fprintf(stderr, "       %s [-p] [-l <layout>] [-r <policy>] -m <rate> -s <s> -E <E> -b <b> -t <tracefile>\n", name);
+    fprintf(stderr, "       %s [-p] [-l <layout>] [-r <policy>] [-G <4k|2m|1g>] -T <entries:ways> [-T ...] -s <s> -E <E> -b <b> -t <tracefile>\n", name);
+    fprintf(stderr, "       %s [-v] [-a <bits|mapfile>] [-n <rows>] [-o <csvfile>] [-w <accesses>] -s <s> -E <E> -b <b> -t <tracefile>\n", name);
+    fprintf(stderr, "       %s [-p] [-j <threads>] [-r <policy>] -S <s:E:b> [-S ...] -t <tracefile>\n", name);
+    fprintf(stderr, "       %s [-p] [-I <inclusion>] -H <s:E:b[:wt][:noalloc]> [-H ...] -t <tracefile>\n", name);
+    fprintf(stderr, "       %s [-v] -R <s list> -b <b> -t <tracefile>\n", name);
+    fprintf(stderr, "       %s [-p] -C <protocol> -s <s> -E <E> -b <b> -t <tracefile> [-t ...]\n", name);
+    fprintf(stderr, "       %s -c <binfile> -t <tracefile>\n", name);
+}
+
 int main(int argc, char *argv[]) {
-    char *tracefile = NULL;
+    char *tracefile = NULL, *binfile = NULL;
+    char *tracefiles[MAX_CORES];
+    int ntraces = 0, coherence = 0;
+    static sweep_config configs[MAX_SWEEP];
+    int nconfigs = 0, nthreads = 0, added, picked;
     int opt;
-    while ((opt = getopt(argc, argv, "hvs:E:b:t:")) != -1) {
+    static reuse_curve curves[MAX_CURVES];
+    int reuse_s[MAX_CURVES], ncurves = 0;
+    while ((opt = getopt(argc, argv, "hvps:E:b:t:c:S:j:l:r:H:I:R:C:a:n:o:w:P:m:T:G:")) != -1) {
         switch (opt) {
             case 'h':
                 hflag = 1;
@@ -199,6 +2440,9 @@ int main(int argc, char *argv[]) {
             case 'v':
                 vflag = 1;
                 break;
+            case 'p':
+                pflag = 1;
+                break;
             case 's':
                 s = atoi(optarg);
                 break;
@@ -209,59 +2453,347 @@ int main(int argc, char *argv[]) {
                 b = atoi(optarg);
                 break;
             case 't':
-                tracefile = optarg;
+                if (ntraces == MAX_CORES) {
+                    fprintf(stderr, "Error: At most %d traces, one per core\n", MAX_CORES);
+                    exit(EXIT_FAILURE);
+                }
+                tracefile = tracefiles[ntraces++] = optarg;
+                break;
+            case 'c':
+                binfile = optarg;
+                break;
+            case 'S':
+                if ((added = parse_sweep(optarg, configs + nconfigs, MAX_SWEEP - nconfigs)) < 0) {
+                    fprintf(stderr, "Error: Bad sweep %s, expected s:E:b with lists like 1,2,4 or ranges like 4-8\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                nconfigs += added;
+                break;
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+            case 'l':
+                if ((picked = select_layout(optarg)) < 0) {
+                    fprintf(stderr, "Error: Unknown or unsupported layout %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                layout = picked;
+                break;
+            case 'H':
+                if (nlevels == MAX_LEVELS || parse_level(optarg, &levels[nlevels]) < 0) {
+                    fprintf(stderr, "Error: Bad level %s, expected s:E:b[:wt][:noalloc], at most %d levels\n", optarg, MAX_LEVELS);
+                    exit(EXIT_FAILURE);
+                }
+                nlevels++;
+                break;
+            case 'R': {
+                char *list = optarg;
+                ncurves = parse_field(&list, reuse_s, MAX_CURVES - 1);
+                if (ncurves < 0 || *list != '\0') {
+                    fprintf(stderr, "Error: Bad set bits %s, expected a list like 0,4,6-8\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                for (int i = 0; i < ncurves; i++)
+                    if (reuse_s[i] > 20) {
+                        fprintf(stderr, "Error: At most 20 set bits for -R\n");
+                        exit(EXIT_FAILURE);
+                    }
+                break;
+            }
+            case 'I':
+                if (select_inclusion(optarg) < 0) {
+                    fprintf(stderr, "Error: Unknown inclusion policy %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'C':
+                if (select_protocol(optarg) < 0) {
+                    fprintf(stderr, "Error: Unknown coherence protocol %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                coherence = 1;
+                break;
+            case 'a':
+                if (parse_regions(optarg) < 0) {
+                    fprintf(stderr, "Error: Bad regions %s, expected bucket bits or a map file\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                attribution = 1;
+                break;
+            case 'n':
+                top_rows = atoi(optarg);
+                break;
+            case 'o':
+                if ((heatmap = fopen(optarg, "w")) == NULL) {
+                    fprintf(stderr, "Error: Couldn't open %s for writing.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                fprintf(heatmap, "window,start,region,hits,misses,evictions\n");
+                attribution = 1;
+                break;
+            case 'w':
+                window = window_left = atoll(optarg);
+                break;
+            case 'm':
+                if ((sample_rate = atoi(optarg)) < 1) {
+                    fprintf(stderr, "Error: Bad sampling rate %s, expected a positive number\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'T':
+                if (ntlbs == MAX_TLBS || parse_tlb(optarg, &tlbs[ntlbs]) < 0) {
+                    fprintf(stderr, "Error: Bad TLB %s, expected entries:ways with a power of 2 number of sets,\n"
+                            "       at most %d levels\n", optarg, MAX_TLBS);
+                    exit(EXIT_FAILURE);
+                }
+                ntlbs++;
+                break;
+            case 'G':
+                if (parse_page(optarg) < 0) {
+                    fprintf(stderr, "Error: Unknown page size %s, expected 4k, 2m or 1g\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'P':
+                if (parse_prefetcher(optarg) < 0) {
+                    fprintf(stderr, "Error: Bad prefetcher %s, expected next, stride or stream[:degree[:latency]],\n"
+                            "       degree at most %d\n", optarg, MAX_DEGREE);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                if ((picked = select_policy(optarg)) < 0) {
+                    fprintf(stderr, "Error: Unknown replacement policy %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                policy = picked;
                 break;
             default:
-                fprintf(stderr, "Usage: %s [-hv] -s <s> -E <E> -b <b> -t <tracefile>\n", argv[0]);
+                usage(argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
 
      // If help flag is set, print usage info and exit
     if (hflag) {
-        fprintf(stderr, "Usage: %s [-hv] -s <s> -E <E> -b <b> -t <tracefile>\n", argv[0]);
+        usage(argv[0]);
         fprintf(stderr, "\nOptions:\n");
         fprintf(stderr, "  -h: Optional help flag that prints usage info\n");
         fprintf(stderr, "  -v: Optional verbose flag that displays trace info\n");
         fprintf(stderr, "  -s <s>: Number of set index bits (S = 2^s is the number of sets)\n");
         fprintf(stderr, "  -E <E>: Associativity (number of lines per set)\n");
         fprintf(stderr, "  -b <b>: Number of block bits (B = 2^b is the block size)\n");
-        fprintf(stderr, "  -t <tracefile>: Name of the valgrind trace to replay\n");
+        fprintf(stderr, "  -p: Optional flag that prints simulation speed in accesses per second\n");
+        fprintf(stderr, "  -t <tracefile>: Name of the valgrind or binary trace to replay, - for stdin\n");
+        fprintf(stderr, "  -c <binfile>: Convert the trace to the binary format in binfile and exit\n");
+        fprintf(stderr, "  -S <s:E:b>: Simulate every listed configuration in one pass, print CSV\n");
+        fprintf(stderr, "  -j <threads>: Worker threads for -S (default: one per CPU), or to split the\n");
+        fprintf(stderr, "               sets of a single cache between (default: 1)\n");
+        fprintf(stderr, "  -l <layout>: aos (default), soa for tag arrays searched with SIMD, or\n");
+        fprintf(stderr, "               soa-scalar, soa-sse, soa-avx2 to pick the search\n");
+        fprintf(stderr, "  -r <policy>: Replacement policy: lru (default), fifo, random, plru, lfu,\n");
+        fprintf(stderr, "               srrip or brrip\n");
+        fprintf(stderr, "  -H <s:E:b>: Add a level to a cache hierarchy, L1 first. Levels write back\n");
+        fprintf(stderr, "               and allocate on writes unless :wt or :noalloc follows\n");
+        fprintf(stderr, "  -I <inclusion>: Hierarchy inclusion policy: nine (default), inclusive or\n");
+        fprintf(stderr, "               exclusive\n");
+        fprintf(stderr, "  -R <s list>: Print LRU miss-ratio curves from reuse distances, fully\n");
+        fprintf(stderr, "               associative and for each listed s, as CSV (-v: every size)\n");
+        fprintf(stderr, "  -a <bits|mapfile>: Also print the top regions, sets and instructions by\n");
+        fprintf(stderr, "               misses. Regions are 2^bits byte buckets (default 12) or the\n");
+        fprintf(stderr, "               \"start size [type] name\" lines of a map file, as nm -S prints\n");
+        fprintf(stderr, "  -n <rows>: Rows of each -a table (default %d)\n", TOP_ROWS);
+        fprintf(stderr, "  -o <csvfile>: Write misses by region and time window as CSV, implies -a\n");
+        fprintf(stderr, "  -w <accesses>: Accesses per -o window (default %d)\n", WINDOW);
+        fprintf(stderr, "  -P <prefetcher[:degree[:latency]]>: Prefetch with next (next line), stride\n");
+        fprintf(stderr, "               (per instruction) or stream (stream buffers). Prefetched data\n");
+        fprintf(stderr, "               arrives latency accesses later (default %d)\n", PREFETCH_LATENCY);
+        fprintf(stderr, "  -C <protocol>: Simulate a private s:E:b cache per core kept coherent with\n");
+        fprintf(stderr, "               mesi or moesi. Give one -t per core, or one trace with the\n");
+        fprintf(stderr, "               core after the size on every line (\" L 10,4,1\")\n");
+        fprintf(stderr, "  -m <rate>: Simulate about one set in rate, spread by a hash, and scale the\n");
+        fprintf(stderr, "               counts up to the whole cache with a 95%% confidence interval\n");
+        fprintf(stderr, "  -T <entries:ways>: Add a TLB level, L1 first, in front of the cache. A miss\n");
+        fprintf(stderr, "               in the last level walks the page table through the data cache\n");
+        fprintf(stderr, "  -G <page>: Page size of the TLBs and the walk: 4k (default), 2m or 1g\n");
+    }
+    if (binfile && tracefile)
+        return convert_trace(tracefile, binfile) < 0 ? EXIT_FAILURE : 0;
+    if (nconfigs > 0 && tracefile) {
+        if (nthreads <= 0)
+            nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nthreads > nconfigs)
+            nthreads = nconfigs;
+        return run_sweep(tracefile, configs, nconfigs, nthreads < 1 ? 1 : nthreads) < 0 ? EXIT_FAILURE : 0;
+    }
+    if (ncurves > 0 && tracefile) {
+        trace_reader trace;
+        if (trace_open(&trace, tracefile) < 0) {
+            fprintf(stderr, "Error: Couldn't open %s for reading.\n", tracefile);
+            exit(EXIT_FAILURE);
+        }
+        int used = 1;
+        reuse_init(&curves[0], 0);      // fully associative first
+        for (int i = 0; i < ncurves; i++)
+            if (reuse_s[i] > 0)
+                reuse_init(&curves[used++], reuse_s[i]);
+        ncurves = used - 1;
+        static trace_record batch[TRACE_BATCH];
+        unsigned long long int accesses = 0;
+        double start = now_sec();
+        int n;
+        while ((n = trace_read(&trace, batch, TRACE_BATCH)) > 0)
+            accesses += replay_reuse(curves, ncurves + 1, batch, n, b);
+        trace_close(&trace);
+        if (pflag) {
+            double secs = now_sec() - start;
+            fprintf(stderr, "%llu accesses in %.3fs, %.2f million accesses/s\n", accesses, secs, accesses / secs / 1e6);
+        }
+        print_curves(curves, ncurves + 1, b);
+        for (int i = 0; i <= ncurves; i++)
+            free_curve(&curves[i]);
+        return 0;
+    }
+    if (coherence && tracefile) {
+        if (E <= 0 || s < 0 || b < 0 || s + b >= 63) {
+            fprintf(stderr, "Error: -C needs the cache of each core as -s, -E and -b\n");
+            exit(EXIT_FAILURE);
+        }
+        if (run_coherence(tracefiles, ntraces) < 0)
+            exit(EXIT_FAILURE);
+        print_coherence();
+        for (int k = 0; k < ncores; k++)
+            free_cache(&cores[k].c);
+        free(blocks);
+        return 0;
+    }
+    if (nlevels > 0 && tracefile) {
+        if (check_hierarchy() < 0)
+            exit(EXIT_FAILURE);
+        for (int k = 0; k < nlevels; k++)           // hierarchy levels are LRU
+            levels[k].c = initialize_cache(levels[k].s, levels[k].E, levels[k].b, POLICY_LRU, LAYOUT_AOS);
+        trace_reader trace;
+        if (trace_open(&trace, tracefile) < 0) {
+            fprintf(stderr, "Error: Couldn't open %s for reading.\n", tracefile);
+            exit(EXIT_FAILURE);
+        }
+        static trace_record batch[TRACE_BATCH];
+        unsigned long long int accesses = 0;
+        double start = now_sec();
+        int n;
+        while ((n = trace_read(&trace, batch, TRACE_BATCH)) > 0)
+            accesses += replay_hierarchy(batch, n);
+        trace_close(&trace);
+        if (pflag) {
+            double secs = now_sec() - start;
+            fprintf(stderr, "%llu accesses in %.3fs, %.2f million accesses/s\n", accesses, secs, accesses / secs / 1e6);
+        }
+        print_hierarchy();
+        for (int k = 0; k < nlevels; k++)
+            free_cache(&levels[k].c);
+        return 0;
     }
         // Check for mandatory arguments
     if (s == 0 || E == 0 || b == 0 || tracefile == NULL) {
         fprintf(stderr, "Error: Missing mandatory argument(s)\n");
-        fprintf(stderr, "Usage: %s [-hv] -s <s> -E <E> -b <b> -t <tracefile>\n", argv[0]);
+        usage(argv[0]);
         exit(EXIT_FAILURE);
     }
 
     /***** Read File *****/
 
-    myCache = initialize_cache(1 << s, E);
-    FILE* trace = fopen(tracefile, "r");
-    if (!trace) {
+    if (check_config(s, E, b) < 0)
+        exit(EXIT_FAILURE);
+    if (attribution && (window <= 0 || top_rows <= 0)) {
+        fprintf(stderr, "Error: -n and -w need a positive count\n");
+        exit(EXIT_FAILURE);
+    }
+    if (prefetcher && (policy != POLICY_LRU || layout != LAYOUT_AOS || attribution)) {
+        fprintf(stderr, "Error: -P runs on the LRU policy and the aos layout, without -a\n");
+        exit(EXIT_FAILURE);
+    }
+    if (sample_rate > 1 && (vflag || attribution || prefetcher)) {
+        fprintf(stderr, "Error: -m runs without -v, -a or -P\n");
+        exit(EXIT_FAILURE);
+    }
+    if (ntlbs && (vflag || attribution || prefetcher || sample_rate > 1)) {
+        fprintf(stderr, "Error: -T runs without -v, -a, -P or -m\n");
+        exit(EXIT_FAILURE);
+    }
+    // -v, -a and -P go in trace order and random and BRRIP share a
+    // generator between sets, those stay serial, and so do a sample and TLBs
+    if (nthreads > 1 && s > 0 && !vflag && !attribution && !prefetcher && sample_rate <= 1 && !ntlbs &&
+        policy != POLICY_RANDOM && policy != POLICY_BRRIP)
+        return run_parallel(tracefile, nthreads) < 0 ? EXIT_FAILURE : 0;
+    myCache = initialize_cache(s, E, b, policy, layout);
+    if (sample_rate > 1) {
+        sampled_sets = sample_sets(&myCache, sample_rate);
+        set_counts = calloc(1 << s, sizeof(*set_counts));
+    }
+    for (int k = 0; k < ntlbs; k++)
+        tlbs[k].c = initialize_cache(__builtin_ctz(tlbs[k].entries / tlbs[k].ways), tlbs[k].ways, page_shift,
+                                     POLICY_LRU, LAYOUT_AOS);
+    if (prefetcher)
+        pf_ready = calloc((size_t)(1 << s) * E, sizeof(*pf_ready));
+    trace_reader trace;
+    if (trace_open(&trace, tracefile) < 0) {
         fprintf(stderr, "Error: Couldn't open %s for reading.\n", tracefile);
         exit(EXIT_FAILURE);
     }
 
-    char operation;
-    unsigned long long address;
-    int size;
-
-    while (fscanf(trace, " %c %llx,%d", &operation, &address, &size) != EOF) {
-        if (operation == 'I') {
-            continue;  // Ignore instruction load operations
-        }
-        process_cache(&myCache, operation, address, size , s, E, b);
+    static trace_record batch[TRACE_BATCH];
+    static unsigned char outcomes[TRACE_BATCH];
+    unsigned long long int accesses = 0;
+    double start = now_sec();
+    int n, evicted = 0;
 
-        if (operation == MODIFY) {
-        process_cache(&myCache, STORE, address, size, s, E, b);
+    while ((n = trace_read(&trace, batch, TRACE_BATCH)) > 0) {
+        if (prefetcher)
+            accesses += replay_prefetch(&myCache, batch, n);
+        else if (attribution)
+            accesses += replay_attributed(&myCache, batch, n, s, b);
+        else if (ntlbs)
+            accesses += replay_tlb(&myCache, batch, n);
+        else if (sample_rate > 1) {
+            replay_batch(&myCache, batch, n, outcomes);
+            accesses += count_sampled(batch, n, outcomes);
+        } else if (vflag) {
+            accesses += replay_batch(&myCache, batch, n, outcomes);
+            print_verbose(batch, n, outcomes, &evicted);
+        } else
+            accesses += replay_batch(&myCache, batch, n, NULL);
     }
-        }
 /***** Close out, Print Results, Free Memory *****/
 
-    fclose(trace);
-    printSummary(hit_count, miss_count, eviction_count);
-    free_cache(&myCache, 1 << s, E);
+    trace_close(&trace);
+    if (pflag) {
+        double secs = now_sec() - start;
+        fprintf(stderr, "%llu accesses in %.3fs, %.2f million accesses/s (%s)\n", accesses, secs, accesses / secs / 1e6, myCache.layout_name);
+    }
+    if (sample_rate > 1) {
+        print_sampling(accesses);
+        free(set_counts);
+    } else if (ntlbs) {                 // the data accesses only, the walks are reported apart
+        print_summary(myCache.hits - walk_hits, myCache.misses - walk_misses, myCache.evictions - walk_evictions);
+        print_tlb();
+        for (int k = 0; k < ntlbs; k++)
+            free_cache(&tlbs[k].c);
+    } else
+        print_summary(myCache.hits, myCache.misses, myCache.evictions);
+    if (prefetcher) {
+        print_prefetch(&myCache);
+        free(pf_ready);
+    }
+    if (attribution) {
+        print_attribution();
+        free_table(&region_table);
+        free_table(&set_table);
+        free_table(&pc_table);
+        free_table(&window_table);
+        for (int i = 0; i < nregions; i++)
+            free(regions[i].name);
+        free(regions);
+    }
+    free_cache(&myCache);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,400 @@
+/*
+ * csimbench - Synthetic traces and a throughput benchmark for csimlib
+ *
+ * Generates one of five access patterns in memory, so the numbers don't
+ * depend on whatever traces are lying around:
+ *
+ *   stream   sequential 8 byte elements over the footprint, wrapping
+ *   stride   one access every -d bytes over the footprint, wrapping
+ *   random   uniform 8 byte elements anywhere in the footprint
+ *   chase    one 64 byte node at a time along a random cycle through
+ *            the footprint, like walking a shuffled linked list
+ *   matrix   8x8 blocked transpose of an N x N matrix of doubles into a
+ *            second one, N picked so both fill the footprint
+ *
+ * Every pattern but matrix stores instead of loading -w percent of the
+ * time. The generator is seeded (-x), so a run is the same trace every
+ * time. Each pattern is replayed into a fresh cache for every
+ * configuration (LRU on the aos and soa layouts, then every other
+ * policy), best of -i runs, and reported in simulated accesses per
+ * second. -c instead checks every LRU replay, access by access, against
+ * a plain reference model and exits 1 on a mismatch. -o writes the
+ * pattern as a valgrind style trace for csim -t.
+ *
+ * Usage: csimbench [-c] [-g pattern] [-n accesses] [-f KB] [-w percent]
+ *                  [-d stride] [-s s -E E -b b] [-i runs] [-x seed] [-o file]
+ */
+
+/**************
+*Dillon Gaughan
+**************/
+
+#define _GNU_SOURCE            // getopt and clock_gettime under -std=c99
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include "csimlib.h"
+
+#define NODE 64                     /* chase node size in bytes */
+#define TILE 8                      /* matrix block size in elements */
+#define BASE 0x10000000ULL          /* where generated data starts */
+
+typedef enum {
+    STREAM,
+    STRIDE,
+    RANDOM,
+    CHASE,
+    MATRIX,
+    PATTERNS
+} pattern_t;
+
+/***** Global Variables *****/
+
+const char *pattern_names[] = {"stream", "stride", "random", "chase", "matrix"};
+long accesses = 1 << 20;           /* records per trace */
+long footprint = 1 << 20;          /* bytes touched */
+int write_pct = 30;                /* stores out of 100 accesses */
+long stride = 256;                 /* bytes between stride accesses */
+int s = 6, E = 8, b = 6;           /* 32KB, 8 way, 64 byte blocks */
+int runs = 3;
+unsigned long long int seed = 1;
+
+/***** Function Headers *****/
+
+double now_sec(void);
+unsigned long long int next_random(void);
+char pick_op(void);
+trace_record *generate(pattern_t pattern, long n);
+int write_trace(const char *file, trace_record *recs, long n);
+void bench(pattern_t pattern, trace_record *recs, long n);
+int check(pattern_t pattern, trace_record *recs, long n);
+void reference(trace_record *recs, long n, unsigned char *outcomes, unsigned long long int *counts);
+void usage(char *name);
+
+/******************
+*Main program start
+******************/
+
+int main(int argc, char **argv)
+{
+    int checking = 0, failed = 0, only = -1;
+    char *outfile = NULL;
+    const char *problem;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hcg:n:f:w:d:s:E:b:i:x:o:")) != -1) {
+        switch (opt) {
+        case 'c':
+            checking = 1;
+            break;
+        case 'g':
+            for (only = 0; only < PATTERNS && strcmp(optarg, pattern_names[only]); only++)
+                ;
+            if (only == PATTERNS) {
+                fprintf(stderr, "Error: Unknown pattern %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'n':
+            accesses = atol(optarg);
+            break;
+        case 'f':
+            footprint = atol(optarg) << 10;
+            break;
+        case 'w':
+            write_pct = atoi(optarg);
+            break;
+        case 'd':
+            stride = atol(optarg);
+            break;
+        case 's':
+            s = atoi(optarg);
+            break;
+        case 'E':
+            E = atoi(optarg);
+            break;
+        case 'b':
+            b = atoi(optarg);
+            break;
+        case 'i':
+            runs = atoi(optarg);
+            break;
+        case 'x':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            outfile = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (accesses <= 0 || accesses > 1 << 30 || footprint < 2 * NODE || write_pct < 0 || write_pct > 100 ||
+        stride <= 0 || runs <= 0 || seed == 0)
+        usage(argv[0]);
+    if ((problem = check_cache(s, E, b, POLICY_LRU, LAYOUT_AOS)) != NULL) {
+        fprintf(stderr, "Error: %s\n", problem);
+        exit(EXIT_FAILURE);
+    }
+    if (outfile && only < 0) {
+        fprintf(stderr, "Error: -o writes one pattern, pick it with -g\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!checking && !outfile)
+        printf("%-7s %-12s %10s %10s %10s %10s   (s=%d E=%d b=%d, %ld accesses, %ld KB)\n",
+               "pattern", "config", "hits", "misses", "evictions", "Macc/s", s, E, b, accesses, footprint >> 10);
+    for (int p = 0; p < PATTERNS; p++) {
+        if (only >= 0 && p != only)
+            continue;
+        trace_record *recs = generate(p, accesses);
+        if (outfile) {
+            if (write_trace(outfile, recs, accesses) < 0)
+                exit(EXIT_FAILURE);
+        } else if (checking) {
+            failed |= check(p, recs, accesses);
+        } else {
+            bench(p, recs, accesses);
+        }
+        free(recs);
+    }
+    if (checking)
+        printf("%s\n", failed ? "FAILED" : "ALL OK");
+    return failed;
+}
+
+/***** Monotonic clock in seconds *****/
+
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/***** xorshift64, seeded by -x *****/
+
+unsigned long long int next_random(void) {
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+char pick_op(void) {
+    return (int)(next_random() % 100) < write_pct ? STORE : LOAD;
+}
+
+/***************
+ * Generators
+ ***************/
+
+/***** n records of the pattern, for the caller to free *****/
+
+trace_record *generate(pattern_t pattern, long n) {
+    trace_record *recs = malloc(n * sizeof(*recs));
+    long elements = footprint / 8, nodes = footprint / NODE, i = 0;
+    unsigned int *next = NULL;
+
+    if (!recs) {
+        fprintf(stderr, "Error: could not allocate %ld records\n", n);
+        exit(EXIT_FAILURE);
+    }
+    if (pattern == CHASE) {
+        // Sattolo's shuffle: one cycle through every node
+        next = malloc(nodes * sizeof(*next));
+        for (long k = 0; k < nodes; k++)
+            next[k] = k;
+        for (long k = nodes - 1; k > 0; k--) {
+            long j = next_random() % k;
+            unsigned int tmp = next[k];
+            next[k] = next[j];
+            next[j] = tmp;
+        }
+    }
+
+    switch (pattern) {
+    case STREAM:
+        for (; i < n; i++)
+            recs[i] = (trace_record){pick_op(), 0, 8, BASE + (i % elements) * 8};
+        break;
+    case STRIDE:
+        for (; i < n; i++)
+            recs[i] = (trace_record){pick_op(), 0, 8, BASE + (unsigned long long int)i * stride % footprint};
+        break;
+    case RANDOM:
+        for (; i < n; i++)
+            recs[i] = (trace_record){pick_op(), 0, 8, BASE + next_random() % elements * 8};
+        break;
+    case CHASE:
+        for (unsigned int node = 0; i < n; i++, node = next[node])
+            recs[i] = (trace_record){pick_op(), 0, 8, BASE + (unsigned long long int)node * NODE};
+        break;
+    case MATRIX: {
+        long N = TILE;
+        while ((N + TILE) * (N + TILE) * 16 <= footprint)
+            N += TILE;
+        unsigned long long int A = BASE, B = BASE + N * N * 8;
+        while (i < n)
+            for (long ii = 0; ii < N && i < n; ii += TILE)
+                for (long jj = 0; jj < N && i < n; jj += TILE)
+                    for (long r = ii; r < ii + TILE && r < N && i < n; r++)
+                        for (long c = jj; c < jj + TILE && c < N && i < n; c++) {
+                            recs[i++] = (trace_record){LOAD, 0, 8, A + (r * N + c) * 8};
+                            if (i < n)
+                                recs[i++] = (trace_record){STORE, 0, 8, B + (c * N + r) * 8};
+                        }
+        break;
+    }
+    default:
+        break;
+    }
+    free(next);
+    return recs;
+}
+
+/***** The records as " L addr,size" lines, the format csim reads *****/
+
+int write_trace(const char *file, trace_record *recs, long n) {
+    FILE *out = fopen(file, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Couldn't open %s for writing.\n", file);
+        return -1;
+    }
+    for (long i = 0; i < n; i++)
+        fprintf(out, " %c %llx,%d\n", recs[i].op, recs[i].address, recs[i].size);
+    return fclose(out);
+}
+
+/***************
+ * Benchmarks
+ ***************/
+
+/***** One line per configuration: best of runs, each on a fresh cache *****/
+
+void bench(pattern_t pattern, trace_record *recs, long n) {
+    static const struct { policy_t policy; layout_t layout; } configs[] = {
+        {POLICY_LRU, LAYOUT_AOS}, {POLICY_LRU, LAYOUT_SOA}, {POLICY_FIFO, LAYOUT_AOS},
+        {POLICY_RANDOM, LAYOUT_AOS}, {POLICY_PLRU, LAYOUT_AOS}, {POLICY_LFU, LAYOUT_AOS},
+        {POLICY_SRRIP, LAYOUT_AOS}, {POLICY_BRRIP, LAYOUT_AOS}
+    };
+    char name[32];
+
+    for (int k = 0; k < (int)(sizeof(configs) / sizeof(configs[0])); k++) {
+        if (check_cache(s, E, b, configs[k].policy, configs[k].layout))
+            continue;                        // plru needs E a power of 2
+        double best = 0;
+        cache c;
+        for (int r = 0; r < runs; r++) {
+            c = initialize_cache(s, E, b, configs[k].policy, configs[k].layout);
+            double start = now_sec();
+            replay_batch(&c, recs, n, NULL);
+            double secs = now_sec() - start;
+            if (r == 0 || secs < best)
+                best = secs;
+            snprintf(name, sizeof(name), "%s/%s", policy_names[configs[k].policy], c.layout_name);
+            if (r < runs - 1)
+                free_cache(&c);
+        }
+        printf("%-7s %-12s %10llu %10llu %10llu %10.2f\n", pattern_names[pattern], name,
+               c.hits, c.misses, c.evictions, n / best / 1e6);
+        free_cache(&c);
+    }
+    fflush(stdout);
+}
+
+/***************
+ * Regression check
+ ***************/
+
+/***** Every LRU layout against the reference, outcome by outcome. Returns
+1 on a mismatch. *****/
+
+int check(pattern_t pattern, trace_record *recs, long n) {
+    static const layout_t layouts[] = {LAYOUT_AOS, LAYOUT_SOA_SCALAR, LAYOUT_SOA};
+    unsigned char *want = malloc(n), *got = malloc(n);
+    unsigned long long int counts[3];
+    int failed = 0;
+
+    reference(recs, n, want, counts);
+    for (int k = 0; k < 3; k++) {
+        cache c = initialize_cache(s, E, b, POLICY_LRU, layouts[k]);
+        replay_batch(&c, recs, n, got);
+        long at = 0;
+        while (at < n && got[at] == want[at])
+            at++;
+        int ok = at == n && c.hits == counts[0] && c.misses == counts[1] && c.evictions == counts[2];
+        printf("%-7s lru/%-10s %s", pattern_names[pattern], c.layout_name, ok ? "ok" : "MISMATCH");
+        if (at < n)
+            printf(", first at access %ld (%llx)", at, recs[at].address);
+        printf("\n");
+        failed |= !ok;
+        free_cache(&c);
+    }
+    free(want);
+    free(got);
+    return failed;
+}
+
+/***** Plain LRU: one timestamp per way, the oldest way of a full set goes.
+counts gets hits, misses and evictions. *****/
+
+void reference(trace_record *recs, long n, unsigned char *outcomes, unsigned long long int *counts) {
+    long sets = 1L << s;
+    unsigned long long int *tags = malloc(sets * E * sizeof(*tags));
+    unsigned long long int *used = calloc(sets * E, sizeof(*used)), clock = 0;
+    unsigned long long int hits = 0, misses = 0, evictions = 0;
+
+    for (long i = 0; i < n; i++) {
+        unsigned long long int block = recs[i].address >> b;
+        unsigned long long int *tag = tags + (block & (sets - 1)) * E, *stamp = used + (block & (sets - 1)) * E;
+        int victim = 0, way;
+        for (way = 0; way < E && !(stamp[way] && tag[way] == block); way++)
+            if (stamp[way] < stamp[victim])
+                victim = way;
+        if (way < E) {
+            stamp[way] = ++clock;
+            hits++;
+            outcomes[i] = ACCESS_HIT;
+        } else {
+            outcomes[i] = ACCESS_MISS;
+            if (stamp[victim]) {
+                evictions++;
+                outcomes[i] |= ACCESS_EVICTION;
+            }
+            tag[victim] = block;
+            stamp[victim] = ++clock;
+            misses++;
+        }
+        if (recs[i].op == MODIFY) {          // the store always hits
+            stamp[way < E ? way : victim] = ++clock;
+            hits++;
+        }
+    }
+    counts[0] = hits;
+    counts[1] = misses;
+    counts[2] = evictions;
+    free(tags);
+    free(used);
+}
+
+/*
+ * usage - print a help message
+ */
+
+void usage(char *name) {
+    printf("Usage: %s [-c] [-g pattern] [-n accesses] [-f KB] [-w percent]\n"
+           "       %*s [-d stride] [-s s -E E -b b] [-i runs] [-x seed] [-o file]\n", name, (int)strlen(name), "");
+    printf("   -c   check every LRU layout against the reference model instead\n");
+    printf("   -g   only this pattern: stream, stride, random, chase or matrix\n");
+    printf("   -n   accesses per trace (default 1048576)\n");
+    printf("   -f   footprint in KB (default 1024)\n");
+    printf("   -w   percent of stores, all but matrix (default 30)\n");
+    printf("   -d   bytes between stride accesses (default 256)\n");
+    printf("   -s, -E, -b   cache geometry (default 6, 8, 6)\n");
+    printf("   -i   runs per configuration, the best is reported (default 3)\n");
+    printf("   -x   generator seed (default 1)\n");
+    printf("   -o   write the -g pattern as a csim trace and exit\n");
+    exit(1);
+}
@@ -0,0 +1,60 @@
+#!/bin/bash
+#
+# csimcheck - Check that every csim mode that can reproduce a plain LRU
+# run does, on synthetic traces from csimbench, after csimbench -c has
+# checked the plain replay itself against its reference model:
+#
+#   -S   each row of a sweep against a plain run of that configuration
+#   -j   a set-parallel run against the serial one
+#   -H   a single write-back level against a plain run
+#   -R   each point of the per-set curves against a plain run of that size
+#   -C   a single core against a plain run
+#
+# Exits 1 and prints every mismatch if any of them disagree.
+#
+# Usage: csimcheck.sh [csim] [csimbench]
+#
+
+csim=${1:-./csim}
+bench=${2:-./csimbench}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+fail=0
+
+mismatch() {
+    echo "MISMATCH $1"
+    echo "  expected: $2"
+    echo "  got:      $3"
+    fail=1
+}
+
+$bench -c -n 100000 -f 256 || fail=1
+
+for pattern in stream stride random chase matrix; do
+    trace=$dir/$pattern.trace
+    $bench -g $pattern -n 100000 -f 256 -o $trace || exit 1
+    for cfg in "1 1 4" "4 2 5" "5 4 6" "6 8 6" "2 16 3"; do
+        set -- $cfg
+        plain=$($csim -s $1 -E $2 -b $3 -t $trace)
+
+        got=$($csim -S $1:$2:$3 -t $trace | awk -F, 'NR == 2 { printf "hits:%s misses:%s evictions:%s", $4, $5, $6 }')
+        [ "$got" == "$plain" ] || mismatch "$pattern -S $1:$2:$3" "$plain" "$got"
+
+        got=$($csim -j 4 -s $1 -E $2 -b $3 -t $trace)
+        [ "$got" == "$plain" ] || mismatch "$pattern -j 4 -s $1 -E $2 -b $3" "$plain" "$got"
+
+        got=$($csim -H $1:$2:$3 -t $trace | sed -n 's/^L1 \(hits:[0-9]* misses:[0-9]* evictions:[0-9]*\).*/\1/p')
+        [ "$got" == "$plain" ] || mismatch "$pattern -H $1:$2:$3" "$plain" "$got"
+
+        got=$($csim -C mesi -s $1 -E $2 -b $3 -t $trace | sed -n 's/^core0 \(hits:[0-9]* misses:[0-9]* evictions:[0-9]*\).*/\1/p')
+        [ "$got" == "$plain" ] || mismatch "$pattern -C mesi -s $1 -E $2 -b $3" "$plain" "$got"
+
+        plain=$(echo "$plain" | sed 's/.*misses:\([0-9]*\).*/\1/')
+        # a curve stops at the size where only cold misses are left
+        got=$($csim -R $1 -b $3 -t $trace | awk -F, -v sets=$((1 << $1)) -v E=$2 '$1 == sets && $2 <= E { m = $4 } END { print m }')
+        [ "$got" == "$plain" ] || mismatch "$pattern -R $1 -b $3 at E=$2 misses" "$plain" "$got"
+    done
+done
+
+[ $fail == 0 ] && echo "ALL OK"
+exit $fail
@@ -0,0 +1,542 @@
+/***** Dillon Gaughan *****/
+
+/***** csimlib - the cache engine behind csim, see csimlib.h. Everything a
+cache needs lives in its cache struct, the only tables here are constant. *****/
+
+#define _GNU_SOURCE            // aligned_alloc under -std=c99
+#include "csimlib.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+const char *policy_names[] = {"lru", "fifo", "random", "plru", "lfu", "srrip", "brrip"};
+
+/***** Internal Functions, kept out of the caller's namespace *****/
+
+static int process_cache(cache *myCache, unsigned long long int address);
+static unsigned long long int next_random(cache *myCache);
+static unsigned int set_hash(unsigned int set);
+static void soa_search_scalar(const unsigned long long int *tags, const unsigned int *stamps, int ways, unsigned long long int tag, search_result *result);
+static void soa_search_sse(const unsigned long long int *tags, const unsigned int *stamps, int ways, unsigned long long int tag, search_result *result);
+static void soa_search_avx2(const unsigned long long int *tags, const unsigned int *stamps, int ways, unsigned long long int tag, search_result *result);
+static void soa_renumber(cache *myCache);
+
+/*****  Implementation *****/
+
+search_result search_in_cache(cache *myCache, unsigned long long int address) {
+    int s = myCache->s, E = myCache->E, b = myCache->b;
+    int S = 1 << s;
+    int set_index; 
+    unsigned long long int tag;  
+
+    set_index = (address >> b) & (S - 1);
+    tag = address >> (s + b);
+    
+    if (myCache->tags) {
+        search_result result = {-1, -1, -1, set_index, tag};
+        size_t base = (size_t)set_index * myCache->ways;
+        myCache->search(myCache->tags + base, myCache->stamps + base, myCache->ways, tag, &result);
+        return result;
+    }
+    cache_set *set = &myCache->sets[set_index];
+    
+    search_result result = {-1, -1, 0, set_index, tag};
+    for (int i = 0; i < E; i++) {
+        if (set->lines[i].valid && set->lines[i].tag == tag) {
+            result.hit_line = i;
+            break;
+        }
+        if (!set->lines[i].valid && result.empty_line == -1) {
+            result.empty_line = i;
+        }
+        if (set->lines[i].lru < set->lines[result.LRU_line].lru) {
+            result.LRU_line = i;
+        }
+    }
+ 
+    return result;
+}
+
+/***** Result Processing Logic ******/
+
+void handle_hit(cache *myCache, search_result result) {
+    if (myCache->tags) {
+        myCache->stamps[(size_t)result.set_index * myCache->ways + result.hit_line] = myCache->lru_counter++;
+    } else {
+        myCache->sets[result.set_index].lines[result.hit_line].lru = myCache->lru_counter++;
+    }
+    myCache->hits++;
+}
+
+void handle_miss(cache *myCache, search_result result) {
+    int line_to_fill = (result.empty_line != -1) ? result.empty_line : result.LRU_line;
+
+    if (result.empty_line == -1) {
+        myCache->evictions++;
+    }
+
+    if (myCache->tags) {
+        size_t way = (size_t)result.set_index * myCache->ways + line_to_fill;
+        myCache->tags[way] = result.tag;
+        myCache->stamps[way] = myCache->lru_counter++;
+    } else {
+        cache_set *set = &myCache->sets[result.set_index];
+        set->lines[line_to_fill].valid = 1;
+        set->lines[line_to_fill].tag = result.tag;
+        set->lines[line_to_fill].lru = myCache->lru_counter++;
+    }
+    myCache->misses++;
+}
+
+/***** One LRU access, returns the ACCESS_ bits *****/
+
+static int process_cache(cache *myCache, unsigned long long int address) {
+    if (myCache->tags && myCache->lru_counter == ~0U)
+        soa_renumber(myCache);            // the 32 bit stamps are about to wrap
+    search_result result = search_in_cache(myCache, address);
+
+    if (result.hit_line != -1) {
+        handle_hit(myCache, result);
+        return ACCESS_HIT;
+    }
+    handle_miss(myCache, result);
+    return result.empty_line == -1 ? ACCESS_MISS | ACCESS_EVICTION : ACCESS_MISS;
+}
+
+/***** One access under a policy other than LRU. Always inlined with a
+constant policy, so each policy gets its own copy of the loop in
+replay_batch with no switch left per access. Returns the ACCESS_ bits. *****/
+
+static inline __attribute__((always_inline))
+int policy_access(cache *myCache, const policy_t policy, unsigned long long int address, int s, int E, int b) {
+    int set_index = (address >> b) & ((1 << s) - 1);
+    unsigned long long int tag = address >> (s + b);
+    cache_line *lines = myCache->sets[set_index].lines;
+    size_t base = (size_t)set_index * E;
+    int way, empty = -1;
+
+    for (way = 0; way < E; way++) {
+        if (lines[way].valid && lines[way].tag == tag)
+            break;
+        if (!lines[way].valid && empty == -1)
+            empty = way;
+    }
+
+    if (way < E) {                                   // hit: update the policy state
+        myCache->hits++;
+        if (policy == POLICY_PLRU) {
+            unsigned long long int bits = myCache->set_meta[set_index];
+            for (int level = E >> 1, node = 1; level; level >>= 1) {
+                int right = (way & level) != 0;      // point the node away from this way
+                bits = right ? bits & ~(1ULL << node) : bits | 1ULL << node;
+                node = 2 * node + right;
+            }
+            myCache->set_meta[set_index] = bits;
+        } else if (policy == POLICY_LFU) {
+            myCache->counts[base + way]++;
+        } else if (policy == POLICY_SRRIP || policy == POLICY_BRRIP) {
+            myCache->rrpv[base + way] = 0;
+        }
+        return ACCESS_HIT;
+    }
+
+    myCache->misses++;
+    int outcome = ACCESS_MISS;
+    if (empty != -1) {
+        way = empty;
+    } else {                                         // miss in a full set: pick the victim
+        myCache->evictions++;
+        outcome |= ACCESS_EVICTION;
+        if (policy == POLICY_FIFO) {
+            way = myCache->set_meta[set_index];
+            myCache->set_meta[set_index] = way + 1 == E ? 0 : way + 1;
+        } else if (policy == POLICY_RANDOM) {
+            way = next_random(myCache) % E;
+        } else if (policy == POLICY_PLRU) {
+            unsigned long long int bits = myCache->set_meta[set_index];
+            way = 0;
+            for (int level = E >> 1, node = 1; level; level >>= 1) {
+                int right = bits >> node & 1;
+                way |= right ? level : 0;
+                node = 2 * node + right;
+            }
+        } else if (policy == POLICY_LFU) {
+            way = 0;
+            for (int i = 1; i < E; i++)
+                if (myCache->counts[base + i] < myCache->counts[base + way])
+                    way = i;
+        } else {                                     // RRIP: first distant way, aging the set until there is one
+            unsigned char *rrpv = myCache->rrpv + base;
+            while (1) {
+                for (way = 0; way < E && rrpv[way] != RRPV_MAX; way++)
+                    ;
+                if (way < E)
+                    break;
+                for (int i = 0; i < E; i++)
+                    rrpv[i]++;
+            }
+        }
+    }
+    lines[way].valid = 1;
+    lines[way].tag = tag;
+    if (policy == POLICY_PLRU) {                     // a fill is an access too
+        unsigned long long int bits = myCache->set_meta[set_index];
+        for (int level = E >> 1, node = 1; level; level >>= 1) {
+            int right = (way & level) != 0;
+            bits = right ? bits & ~(1ULL << node) : bits | 1ULL << node;
+            node = 2 * node + right;
+        }
+        myCache->set_meta[set_index] = bits;
+    } else if (policy == POLICY_LFU) {
+        myCache->counts[base + way] = 1;
+    } else if (policy == POLICY_SRRIP) {
+        myCache->rrpv[base + way] = RRPV_MAX - 1;
+    } else if (policy == POLICY_BRRIP) {
+        myCache->rrpv[base + way] = next_random(myCache) % BRRIP_NEAR ? RRPV_MAX : RRPV_MAX - 1;
+    }
+    return outcome;
+}
+
+static inline __attribute__((always_inline))
+int replay_policy(cache *myCache, const policy_t policy, const trace_record *recs, int n, unsigned char *outcomes) {
+    const int s = myCache->s, E = myCache->E, b = myCache->b;
+    int accesses = 0;
+    for (int i = 0; i < n; i++) {
+        const trace_record *rec = &recs[i];
+        if (rec->op == 'I' || (myCache->sample && !myCache->sample[(rec->address >> b) & ((1 << s) - 1)])) {
+            if (outcomes)
+                outcomes[i] = ACCESS_SKIPPED;
+            continue;  // Ignore instruction loads and sets left out of the sample
+        }
+        int outcome = policy_access(myCache, policy, rec->address, s, E, b);
+        if (outcomes)
+            outcomes[i] = outcome;
+        if (rec->op == MODIFY)
+            policy_access(myCache, policy, rec->address, s, E, b);   // the store always hits
+        accesses++;
+    }
+    return accesses;
+}
+
+/***** Replay n trace records into a cache, returns the number of data
+accesses simulated. outcomes, if not NULL, gets the ACCESS_ bits of every record. The
+switch picks a specialised loop once per batch. *****/
+
+int replay_batch(cache *myCache, const trace_record *recs, int n, unsigned char *outcomes) {
+    const int s = myCache->s, b = myCache->b;
+    int accesses = 0;
+    switch (myCache->policy) {
+        case POLICY_LRU:
+            for (int i = 0; i < n; i++) {
+                const trace_record *rec = &recs[i];
+                if (rec->op == 'I' || (myCache->sample && !myCache->sample[(rec->address >> b) & ((1 << s) - 1)])) {
+                    if (outcomes)
+                        outcomes[i] = ACCESS_SKIPPED;
+                    continue;  // Ignore instruction loads and sets left out of the sample
+                }
+                int outcome = process_cache(myCache, rec->address);
+                if (outcomes)
+                    outcomes[i] = outcome;
+
+                if (rec->op == MODIFY) {
+                    process_cache(myCache, rec->address);
+                }
+                accesses++;
+            }
+            return accesses;
+        case POLICY_FIFO:
+            return replay_policy(myCache, POLICY_FIFO, recs, n, outcomes);
+        case POLICY_RANDOM:
+            return replay_policy(myCache, POLICY_RANDOM, recs, n, outcomes);
+        case POLICY_PLRU:
+            return replay_policy(myCache, POLICY_PLRU, recs, n, outcomes);
+        case POLICY_LFU:
+            return replay_policy(myCache, POLICY_LFU, recs, n, outcomes);
+        case POLICY_SRRIP:
+            return replay_policy(myCache, POLICY_SRRIP, recs, n, outcomes);
+        case POLICY_BRRIP:
+            return replay_policy(myCache, POLICY_BRRIP, recs, n, outcomes);
+    }
+    return accesses;
+}
+
+/***** Replacement policy by name, -1 if unknown *****/
+
+int select_policy(const char *name) {
+    for (int i = 0; i <= POLICY_BRRIP; i++)
+        if (strcmp(name, policy_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+/***** NULL if initialize_cache can build the cache, otherwise why not *****/
+
+const char *check_cache(int s, int E, int b, policy_t policy, layout_t layout) {
+    if (s < 0 || E <= 0 || b < 0 || s + b >= 64 || s > 30)
+        return "Bad cache geometry";
+    if (policy < POLICY_LRU || policy > POLICY_BRRIP)
+        return "Unknown replacement policy";
+    if (layout != LAYOUT_AOS && s + b == 0)
+        return "The soa layout needs s + b >= 1";
+    if (policy != POLICY_LRU && layout != LAYOUT_AOS)
+        return "Replacement policies other than lru need the aos layout";
+    if (policy == POLICY_PLRU && (E > 64 || (E & (E - 1))))
+        return "plru needs E to be a power of 2 no larger than 64";
+    return NULL;
+}
+
+static unsigned long long int next_random(cache *myCache) {
+    myCache->rng ^= myCache->rng << 13;
+    myCache->rng ^= myCache->rng >> 7;
+    myCache->rng ^= myCache->rng << 17;
+    return myCache->rng;
+}
+
+/***** Memory allocation and Cache Initialization. The arguments must pass
+check_cache. *****/
+
+cache initialize_cache(int s, int E, int b, policy_t policy, layout_t layout) {
+    cache newCache = {0};
+    int S = 1 << s;
+
+    newCache.s = s;
+    newCache.E = E;
+    newCache.b = b;
+    newCache.layout_name = "aos";
+    if (layout != LAYOUT_AOS) {
+        // Tags and stamps of a set are contiguous, padding ways never match
+        // and never look least recently used
+        newCache.search = soa_search_scalar;
+        newCache.layout_name = "soa-scalar";
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if ((layout == LAYOUT_SOA || layout == LAYOUT_SOA_AVX2) && __builtin_cpu_supports("avx2")) {
+            newCache.search = soa_search_avx2;
+            newCache.layout_name = "soa-avx2";
+        } else if ((layout == LAYOUT_SOA || layout == LAYOUT_SOA_SSE) && __builtin_cpu_supports("sse4.1")) {
+            newCache.search = soa_search_sse;
+            newCache.layout_name = "soa-sse";
+        }
+#endif
+        newCache.ways = (E + SOA_PAD - 1) / SOA_PAD * SOA_PAD;
+        size_t n = (size_t)S * newCache.ways;
+        newCache.tags = aligned_alloc(64, (n * sizeof(*newCache.tags) + 63) & ~(size_t)63);
+        newCache.stamps = aligned_alloc(64, (n * sizeof(*newCache.stamps) + 63) & ~(size_t)63);
+        for (size_t i = 0; i < n; i++) {
+            int pad = i % newCache.ways >= (size_t)E;
+            newCache.tags[i] = pad ? PAD_TAG : INVALID_TAG;
+            newCache.stamps[i] = pad ? ~0U : 0;
+        }
+        return newCache;
+    }
+
+    // Policy metadata, zeroed: way 0 goes first, all counts and values 0
+    newCache.policy = policy;
+    newCache.rng = 0x9e3779b97f4a7c15ULL;
+    if (policy == POLICY_FIFO || policy == POLICY_PLRU)
+        newCache.set_meta = calloc(S, sizeof(*newCache.set_meta));
+    else if (policy == POLICY_LFU)
+        newCache.counts = calloc((size_t)S * E, sizeof(*newCache.counts));
+    else if (policy == POLICY_SRRIP || policy == POLICY_BRRIP)
+        newCache.rrpv = calloc((size_t)S * E, sizeof(*newCache.rrpv));
+
+    // Allocate memory for the sets
+    newCache.sets = (cache_set*) malloc(S * sizeof(cache_set));
+
+    // Allocate a contiguous block of memory for all cache lines of all sets
+    cache_line* allLines = (cache_line*) malloc((size_t)S * E * sizeof(cache_line));
+
+    // Initialize every cache line to default values and assign pointers to appropriate sections
+    for (int i = 0; i < S; i++) {
+        newCache.sets[i].lines = allLines + ((size_t)i * E); // Point to the appropriate section in the contiguous block
+        for (int j = 0; j < E; j++) {
+            newCache.sets[i].lines[j].valid = 0;
+            newCache.sets[i].lines[j].dirty = 0;
+            newCache.sets[i].lines[j].tag = 0;
+            newCache.sets[i].lines[j].lru = 0;
+            newCache.sets[i].lines[j].state = 0;
+        }
+    }
+
+    return newCache;
+}
+
+/***** Free memory allocated for cache *****/
+
+void free_cache(cache *myCache) {
+    free(myCache->sample);
+    if (myCache->tags) {
+        free(myCache->tags);
+        free(myCache->stamps);
+        return;
+    }
+    free(myCache->set_meta);
+    free(myCache->counts);
+    free(myCache->rrpv);
+    free(myCache->sets[0].lines);  // free the entire block of cache lines
+    free(myCache->sets);  // free the sets
+}
+
+/***** SoA search: the hit way, else the first empty way, else the least
+recently used one, the same answers search_in_cache gives *****/
+
+static void soa_search_scalar(const unsigned long long int *tags, const unsigned int *stamps, int ways,
+                       unsigned long long int tag, search_result *result) {
+    int lru = 0;
+    for (int i = 0; i < ways; i++) {
+        if (tags[i] == tag) {
+            result->hit_line = i;
+            return;
+        }
+        if (tags[i] == INVALID_TAG && result->empty_line == -1)
+            result->empty_line = i;
+        if (stamps[i] < stamps[lru])
+            lru = i;
+    }
+    result->LRU_line = lru;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static __attribute__((target("sse4.1")))
+void soa_search_sse(const unsigned long long int *tags, const unsigned int *stamps, int ways,
+                    unsigned long long int tag, search_result *result) {
+    __m128i want = _mm_set1_epi64x(tag), empty = _mm_set1_epi64x(INVALID_TAG);
+    for (int i = 0; i < ways; i += 2) {
+        __m128i t = _mm_load_si128((const __m128i *)(tags + i));
+        int hit = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(t, want)));
+        if (hit) {
+            result->hit_line = i + __builtin_ctz(hit);
+            return;
+        }
+        int free = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(t, empty)));
+        if (free && result->empty_line == -1)
+            result->empty_line = i + __builtin_ctz(free);
+    }
+    if (result->empty_line != -1)
+        return;                                   // a victim is only needed when the set is full
+    __m128i low = _mm_set1_epi32(-1);
+    for (int i = 0; i < ways; i += 4)
+        low = _mm_min_epu32(low, _mm_load_si128((const __m128i *)(stamps + i)));
+    low = _mm_min_epu32(low, _mm_shuffle_epi32(low, 0x4e));
+    low = _mm_min_epu32(low, _mm_shuffle_epi32(low, 0xb1));
+    for (int i = 0; i < ways; i += 4) {
+        __m128i eq = _mm_cmpeq_epi32(_mm_load_si128((const __m128i *)(stamps + i)), low);
+        int at = _mm_movemask_ps(_mm_castsi128_ps(eq));
+        if (at) {
+            result->LRU_line = i + __builtin_ctz(at);
+            return;
+        }
+    }
+}
+
+static __attribute__((target("avx2")))
+void soa_search_avx2(const unsigned long long int *tags, const unsigned int *stamps, int ways,
+                     unsigned long long int tag, search_result *result) {
+    __m256i want = _mm256_set1_epi64x(tag), empty = _mm256_set1_epi64x(INVALID_TAG);
+    for (int i = 0; i < ways; i += 4) {
+        __m256i t = _mm256_load_si256((const __m256i *)(tags + i));
+        int hit = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(t, want)));
+        if (hit) {
+            result->hit_line = i + __builtin_ctz(hit);
+            return;
+        }
+        int free = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(t, empty)));
+        if (free && result->empty_line == -1)
+            result->empty_line = i + __builtin_ctz(free);
+    }
+    if (result->empty_line != -1)
+        return;
+    __m256i low = _mm256_set1_epi32(-1);
+    for (int i = 0; i < ways; i += 8)
+        low = _mm256_min_epu32(low, _mm256_load_si256((const __m256i *)(stamps + i)));
+    low = _mm256_min_epu32(low, _mm256_permute2x128_si256(low, low, 1));
+    low = _mm256_min_epu32(low, _mm256_shuffle_epi32(low, 0x4e));
+    low = _mm256_min_epu32(low, _mm256_shuffle_epi32(low, 0xb1));
+    for (int i = 0; i < ways; i += 8) {
+        __m256i eq = _mm256_cmpeq_epi32(_mm256_load_si256((const __m256i *)(stamps + i)), low);
+        int at = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+        if (at) {
+            result->LRU_line = i + __builtin_ctz(at);
+            return;
+        }
+    }
+}
+
+#endif
+
+/***** Simulate about one set in rate, picked by a hash of the set index
+so neighbouring sets aren't sampled together. Accesses to the other sets
+are skipped as soon as their set index is known. Returns the number of
+sets simulated, always at least one. *****/
+
+int sample_sets(cache *myCache, int rate) {
+    int S = 1 << myCache->s, sampled = 0;
+
+    free(myCache->sample);
+    myCache->sample = malloc(S);
+    for (int set = 0; set < S; set++)
+        sampled += myCache->sample[set] = set_hash(set) % rate == 0;
+    if (sampled == 0)
+        sampled = myCache->sample[0] = 1;
+    return sampled;
+}
+
+/***** murmur3's finalizer, every input bit moves every output bit *****/
+
+static unsigned int set_hash(unsigned int set) {
+    set ^= set >> 16;
+    set *= 0x85ebca6b;
+    set ^= set >> 13;
+    set *= 0xc2b2ae35;
+    set ^= set >> 16;
+    return set;
+}
+
+/***** Layout by name: aos, soa (best search this CPU has), or soa-scalar,
+soa-sse, soa-avx2 to force one. Returns -1 if unknown or not supported
+here. *****/
+
+int select_layout(const char *name) {
+    if (strcmp(name, "aos") == 0)
+        return LAYOUT_AOS;
+    if (strcmp(name, "soa") == 0)
+        return LAYOUT_SOA;
+    if (strcmp(name, "soa-scalar") == 0)
+        return LAYOUT_SOA_SCALAR;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (strcmp(name, "soa-sse") == 0 && __builtin_cpu_supports("sse4.1"))
+        return LAYOUT_SOA_SSE;
+    if (strcmp(name, "soa-avx2") == 0 && __builtin_cpu_supports("avx2"))
+        return LAYOUT_SOA_AVX2;
+#endif
+    return -1;
+}
+
+/***** The LRU clock is about to overflow the 32 bit stamps. Only the order
+of stamps within a set matters, so replace each valid way's stamp with its
+rank in the set and restart the clock above the largest rank. *****/
+
+static void soa_renumber(cache *myCache) {
+    int S = 1 << myCache->s;
+    int ways = myCache->ways;
+    unsigned int *rank = malloc(ways * sizeof(*rank));
+    for (int set = 0; set < S; set++) {
+        unsigned long long int *tags = myCache->tags + (size_t)set * ways;
+        unsigned int *stamps = myCache->stamps + (size_t)set * ways;
+        for (int i = 0; i < ways; i++) {
+            rank[i] = 0;
+            for (int j = 0; j < ways; j++)
+                if (tags[j] != INVALID_TAG && tags[j] != PAD_TAG && stamps[j] < stamps[i])
+                    rank[i]++;
+        }
+        for (int i = 0; i < ways; i++)
+            if (tags[i] != INVALID_TAG && tags[i] != PAD_TAG)
+                stamps[i] = rank[i];
+    }
+    free(rank);
+    myCache->lru_counter = ways;
+}
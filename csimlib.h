@@ -0,0 +1,143 @@
+/***** Dillon Gaughan *****/
+
+/***** csimlib - the cache simulator behind csim as a library. A cache owns
+its geometry, replacement policy, layout and counters, nothing is global,
+so one process can run any number of caches, from any number of threads as
+long as each cache has one user at a time. Records go in as whole arrays:
+
+    cache c = initialize_cache(5, 1, 5, POLICY_LRU, LAYOUT_AOS);
+    replay_batch(&c, recs, n, outcomes);     // outcomes may be NULL
+    printf("%d %d %d\n", c.hits, c.misses, c.evictions);
+    free_cache(&c);
+
+csim.c is the command line front end, trans.c uses it to grade transposes
+without valgrind. *****/
+
+#ifndef CSIMLIB_H
+#define CSIMLIB_H
+
+#include <stddef.h>
+
+/***** Valid bit, Tag bits, local LRU counter *****/
+
+typedef struct {
+    int valid;
+    int dirty;                  // written since the fill, csim hierarchy mode only
+    unsigned long long int tag;
+    unsigned long long int lru; // stamp from lru_counter, as wide so it never wraps
+    int state;                  // MESI state, csim coherence mode only
+} cache_line;
+
+typedef struct {
+    cache_line* lines;
+} cache_set;
+
+/***** The structure-of-arrays layout (LAYOUT_SOA) keeps each set's tags
+and LRU stamps in separate contiguous arrays, padded to a multiple of 8
+ways so whole vectors can be compared. An invalid way holds INVALID_TAG and
+a padding way PAD_TAG, neither can be a real tag since s + b >= 1. *****/
+
+#define SOA_PAD 8
+#define INVALID_TAG (~0ULL)
+#define PAD_TAG (~0ULL - 1)
+
+typedef enum {
+    LAYOUT_AOS,
+    LAYOUT_SOA,                 // the best search this CPU has
+    LAYOUT_SOA_SCALAR,
+    LAYOUT_SOA_SSE,
+    LAYOUT_SOA_AVX2
+} layout_t;
+
+/***** Replacement policies. LRU keeps the original path, the others each
+keep their own metadata next to the cache_line array:
+    FIFO     per set, the next way to replace
+    random   nothing, one xorshift generator per cache
+    PLRU     per set, the E - 1 bits of a binary tree (E a power of 2, <= 64)
+    LFU      per way, an access count
+    SRRIP    per way, a 2 bit re-reference prediction value, filled as long
+    BRRIP    same, filled as distant except once every BRRIP_NEAR fills *****/
+
+typedef enum {
+    POLICY_LRU,
+    POLICY_FIFO,
+    POLICY_RANDOM,
+    POLICY_PLRU,
+    POLICY_LFU,
+    POLICY_SRRIP,
+    POLICY_BRRIP
+} policy_t;
+
+#define RRPV_MAX 3
+#define BRRIP_NEAR 32
+
+typedef struct {
+    int hit_line;
+    int empty_line;
+    int LRU_line;
+    int set_index;
+    unsigned long long int tag;
+} search_result;
+
+typedef void (*soa_search_t)(const unsigned long long int *tags, const unsigned int *stamps, int ways,
+                             unsigned long long int tag, search_result *result);
+
+typedef struct {
+    int s, E, b;                         // 2^s sets of E lines of 2^b bytes
+    cache_set* sets;
+    policy_t policy;
+    unsigned long long int *set_meta;    // FIFO next way or PLRU tree bits, one per set
+    unsigned int *counts;                // LFU counts, one per way
+    unsigned char *rrpv;                 // RRIP values, one per way
+    unsigned long long int rng;          // random and BRRIP state
+    unsigned long long int *tags;        // SoA layout only, NULL otherwise
+    unsigned int *stamps;                // SoA LRU stamps, same shape as tags
+    int ways;                            // SoA ways per set including padding
+    soa_search_t search;                 // SoA search picked for this CPU
+    const char *layout_name;             // the layout and search in use
+    unsigned char *sample;               // per set, 1 if simulated, NULL simulates every set
+    unsigned long long int hits;
+    unsigned long long int misses;
+    unsigned long long int evictions;
+    unsigned long long int lru_counter;  // LRU clock, local to the cache
+} cache;
+
+typedef enum {
+    LOAD = 'L',
+    STORE = 'S',
+    MODIFY = 'M'
+} operation_t;
+
+/***** One trace line, I records included so callers can see them *****/
+
+typedef struct {
+    char op;
+    unsigned char core;         // tagged traces only, 0 otherwise
+    int size;
+    unsigned long long int address;
+} trace_record;
+
+/***** What replay_batch did with each record when asked. An M record's
+store always hits, so the bits describe its load. *****/
+
+#define ACCESS_HIT 0
+#define ACCESS_MISS 1
+#define ACCESS_EVICTION 2           // the miss evicted a valid line
+#define ACCESS_SKIPPED 4            // an I record or a set sample_sets left out
+
+/***** Library Functions *****/
+
+cache initialize_cache(int s, int E, int b, policy_t policy, layout_t layout);
+void free_cache(cache *myCache);
+const char *check_cache(int s, int E, int b, policy_t policy, layout_t layout);
+int replay_batch(cache *myCache, const trace_record *recs, int n, unsigned char *outcomes);
+int select_policy(const char *name);
+int select_layout(const char *name);
+int sample_sets(cache *myCache, int rate);
+search_result search_in_cache(cache *myCache, unsigned long long int address);
+void handle_hit(cache *myCache, search_result result);
+void handle_miss(cache *myCache, search_result result);
+
+extern const char *policy_names[];
+
+#endif
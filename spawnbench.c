@@ -0,0 +1,176 @@
+/*
+ * spawnbench - Micro-benchmark of the two tsh process-launch paths
+ *
+ * Launches the same short command over and over, once with the fork +
+ * setpgid + execvp sequence and once with posix_spawnp using
+ * POSIX_SPAWN_SETPGROUP and POSIX_SPAWN_SETSIGMASK, exactly as tsh does
+ * in execute_command. The benchmark can grow its own resident set first
+ * (-m) since the cost of fork scales with the size of the parent.
+ *
+ * Usage: spawnbench [-n iterations] [-m megabytes] [command [args...]]
+ */
+
+/**************
+*Dillon Gaughan
+**************/
+
+#define _GNU_SOURCE            // getopt, sigprocmask and clock_gettime under -std=c99
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+/***** Function Headers *****/
+
+double now_usec(void);
+pid_t bench_fork(char **argv, sigset_t *child_mask);
+pid_t bench_spawn(char **argv, sigset_t *child_mask);
+void run_bench(const char *name, pid_t (*launch)(char **, sigset_t *), char **argv, sigset_t *child_mask, int iters);
+int compare_double(const void *a, const void *b);
+void usage(char *name);
+
+/******************
+*Main program start
+******************/
+
+int main(int argc, char **argv)
+{
+    char *default_cmd[] = {"/bin/true", NULL};
+    char **cmd = default_cmd;
+    int iters = 1000;
+    long megabytes = 0;
+    char *ballast = NULL;
+    sigset_t block, child_mask;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:m:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iters = atoi(optarg);
+            break;
+        case 'm':
+            megabytes = atol(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc)
+        cmd = &argv[optind];
+    if (iters <= 0)
+        usage(argv[0]);
+
+    /***** Touch every page so the ballast is really resident *****/
+    if (megabytes > 0) {
+        ballast = malloc(megabytes << 20);
+        if (!ballast) {
+            fprintf(stderr, "Error: could not allocate %ld MB\n", megabytes);
+            exit(EXIT_FAILURE);
+        }
+        memset(ballast, 1, megabytes << 20);
+    }
+
+    /***** Same mask state as tsh: SIGCHLD blocked in the parent only *****/
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &child_mask);
+
+    printf("command: %s, iterations: %d, resident ballast: %ld MB\n", cmd[0], iters, megabytes);
+    run_bench("fork", bench_fork, cmd, &child_mask, iters);
+    run_bench("posix_spawn", bench_spawn, cmd, &child_mask, iters);
+
+    free(ballast);
+    return 0;
+}
+
+/***** Monotonic clock in microseconds *****/
+
+double now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/***** fork path, mirrors fork_process in tsh *****/
+
+pid_t bench_fork(char **argv, sigset_t *child_mask) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        sigprocmask(SIG_SETMASK, child_mask, NULL);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+/***** posix_spawn path, mirrors spawn_process in tsh *****/
+
+pid_t bench_spawn(char **argv, sigset_t *child_mask) {
+    posix_spawnattr_t attr;
+    pid_t pid;
+    int err;
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setsigmask(&attr, child_mask);
+    err = posix_spawnp(&pid, argv[0], NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    return err == 0 ? pid : -1;
+}
+
+/***** Time launch-to-return of the launcher and launch-to-reap of the child *****/
+
+void run_bench(const char *name, pid_t (*launch)(char **, sigset_t *), char **argv, sigset_t *child_mask, int iters) {
+    double *launch_us = malloc(iters * sizeof(double));
+    double *total_us = malloc(iters * sizeof(double));
+    double start, launch_sum = 0, total_sum = 0;
+    int i, status;
+    pid_t pid;
+
+    for (i = 0; i < iters; i++) {
+        start = now_usec();
+        if ((pid = launch(argv, child_mask)) < 0) {
+            fprintf(stderr, "%s: could not launch %s\n", name, argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        launch_us[i] = now_usec() - start;
+        waitpid(pid, &status, 0);
+        total_us[i] = now_usec() - start;
+        launch_sum += launch_us[i];
+        total_sum += total_us[i];
+    }
+    qsort(launch_us, iters, sizeof(double), compare_double);
+    qsort(total_us, iters, sizeof(double), compare_double);
+
+    printf("%-12s launch: min %8.1f  p50 %8.1f  p99 %8.1f  mean %8.1f us\n", name,
+           launch_us[0], launch_us[iters / 2], launch_us[iters * 99 / 100], launch_sum / iters);
+    printf("%-12s reaped: min %8.1f  p50 %8.1f  p99 %8.1f  mean %8.1f us\n", name,
+           total_us[0], total_us[iters / 2], total_us[iters * 99 / 100], total_sum / iters);
+    free(launch_us);
+    free(total_us);
+}
+
+int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * usage - print a help message
+ */
+
+void usage(char *name) {
+    printf("Usage: %s [-n iterations] [-m megabytes] [command [args...]]\n", name);
+    printf("   -n   number of launches per path (default 1000)\n");
+    printf("   -m   megabytes of resident memory to hold while launching\n");
+    exit(1);
+}
@@ -22,15 +22,42 @@
 #include <stdio.h>
 #include "cachelab.h"
 
+/***** Loop orders of transpose_blocked, the bits combine. ORDER_QUAD is the
+8x8 quadrant kernel of transpose_64 instead. *****/
+
+#define ORDER_COLS 1            // inside a block, down the columns of A
+#define ORDER_BLOCK_COLS 2      // blocks down the columns of A, not across its rows
+#define ORDER_QUAD 4
+
+/***** Element access of the tuned kernels. The TRANS_EVAL build records
+every access they make while eval_on is set, see the end of the file. *****/
+
+#ifdef TRANS_EVAL
+int eval_load(const int *p);
+void eval_store(int *p, int v);
+#define LD(X, r, c) eval_load(&X[r][c])
+#define ST(X, r, c, v) eval_store(&X[r][c], (v))
+#else
+#define LD(X, r, c) X[r][c]
+#define ST(X, r, c, v) (X[r][c] = (v))
+#endif
+
 int is_transpose(int M, int N, int A[N][M], int B[M][N]);
 void transpose_32(int M, int N, int A[N][M], int B[M][N]);
 void transpose_64(int M, int N, int A[N][M], int B[M][N]);
 void transpose_other(int M, int N, int A[N][M], int B[M][N]);
+void transpose_blocked(int M, int N, int A[N][M], int B[M][N], int order, int bh, int bw);
 
-/***** Conditional function calling to create a more organized code layout. *****/
+/***** Conditional function calling to create a more organized code layout.
+Shapes the tuner has seen go to their best kernel first, trans_tuned.h is
+its output: one TUNED(M, N, order, block rows, block columns) per shape. *****/
 
 char transpose_submit_desc[] = "Transpose submission";
 void transpose_submit(int M, int N, int A[N][M], int B[M][N]) {
+#define TUNED(m, n, order, bh, bw) \
+    if (M == (m) && N == (n)) { transpose_blocked(M, N, A, B, order, bh, bw); return; }
+#include "trans_tuned.h"
+#undef TUNED
     if (N == 32 && M == 32) {
         // 32x32 matrix
         transpose_32(M, N, A, B);
@@ -87,55 +114,55 @@ void transpose_64(int M, int N, int A[N][M], int B[M][N]){
     for (j = 0; j < M; j += 8) {
         for (i = 0; i < N; i += 8) {
             for (ii = i; ii < i + 4; ii++) {
-                tmp0 = A[ii][j];
-                tmp1 = A[ii][j + 1];
-                tmp2 = A[ii][j + 2];
-                tmp3 = A[ii][j + 3];
-                tmp4 = A[ii][j + 4];
-                tmp5 = A[ii][j + 5];
-                tmp6 = A[ii][j + 6];
-                tmp7 = A[ii][j + 7];
+                tmp0 = LD(A, ii, j);
+                tmp1 = LD(A, ii, j + 1);
+                tmp2 = LD(A, ii, j + 2);
+                tmp3 = LD(A, ii, j + 3);
+                tmp4 = LD(A, ii, j + 4);
+                tmp5 = LD(A, ii, j + 5);
+                tmp6 = LD(A, ii, j + 6);
+                tmp7 = LD(A, ii, j + 7);
                 //left-above, store right above
-                B[j][ii] = tmp0;
-                B[j + 1][ii] = tmp1;
-                B[j + 2][ii] = tmp2;
-                B[j + 3][ii] = tmp3;
-                B[j][ii + 4] = tmp4;
-                B[j + 1][ii + 4] = tmp5;
-                B[j + 2][ii + 4] = tmp6;
-                B[j + 3][ii + 4] = tmp7;
+                ST(B, j, ii, tmp0);
+                ST(B, j + 1, ii, tmp1);
+                ST(B, j + 2, ii, tmp2);
+                ST(B, j + 3, ii, tmp3);
+                ST(B, j, ii + 4, tmp4);
+                ST(B, j + 1, ii + 4, tmp5);
+                ST(B, j + 2, ii + 4, tmp6);
+                ST(B, j + 3, ii + 4, tmp7);
                 }
             for (jj = j; jj < j + 4; jj++) {
 
                     // A left-down
-                tmp4 = A[i + 4][jj];
-                tmp5 = A[i + 5][jj];
-                tmp6 = A[i + 6][jj];
-                tmp7 = A[i + 7][jj];
+                tmp4 = LD(A, i + 4, jj);
+                tmp5 = LD(A, i + 5, jj);
+                tmp6 = LD(A, i + 6, jj);
+                tmp7 = LD(A, i + 7, jj);
 
                     // B right-above
-                tmp0 = B[jj][i + 4];
-                tmp1 = B[jj][i + 5];
-                tmp2 = B[jj][i + 6];
-                tmp3 = B[jj][i + 7];
+                tmp0 = LD(B, jj, i + 4);
+                tmp1 = LD(B, jj, i + 5);
+                tmp2 = LD(B, jj, i + 6);
+                tmp3 = LD(B, jj, i + 7);
 
                     // set B right-above
-                B[jj][i + 4] = tmp4;
-                B[jj][i + 5] = tmp5;
-                B[jj][i + 6] = tmp6;
-                B[jj][i + 7] = tmp7;
+                ST(B, jj, i + 4, tmp4);
+                ST(B, jj, i + 5, tmp5);
+                ST(B, jj, i + 6, tmp6);
+                ST(B, jj, i + 7, tmp7);
 
                     // set B left-down
-                B[jj + 4][i] = tmp0;
-                B[jj + 4][i + 1] = tmp1;
-                B[jj + 4][i + 2] = tmp2;
-                B[jj + 4][i + 3] = tmp3;
+                ST(B, jj + 4, i, tmp0);
+                ST(B, jj + 4, i + 1, tmp1);
+                ST(B, jj + 4, i + 2, tmp2);
+                ST(B, jj + 4, i + 3, tmp3);
 
                     // set B right-down
-                B[jj + 4][i + 4] = A[i + 4][jj + 4];
-                B[jj + 4][i + 5] = A[i + 5][jj + 4];
-                B[jj + 4][i + 6] = A[i + 6][jj + 4];
-                B[jj + 4][i + 7] = A[i + 7][jj + 4];
+                ST(B, jj + 4, i + 4, LD(A, i + 4, jj + 4));
+                ST(B, jj + 4, i + 5, LD(A, i + 5, jj + 4));
+                ST(B, jj + 4, i + 6, LD(A, i + 6, jj + 4));
+                ST(B, jj + 4, i + 7, LD(A, i + 7, jj + 4));
             }        
         }   
     }
@@ -171,6 +198,56 @@ void transpose_other(int M, int N, int A[N][M], int B[M][N]){
 	}
 }
 
+/***** Any shape in bh x bw blocks of A, in one of the ORDER_ loop orders,
+with the diagonal handling of transpose_32. The kernel behind the tuned
+shapes; ORDER_QUAD hands 8x8 multiples to transpose_64. *****/
+
+char transpose_blocked_desc[] = "Blocked transpose, any block shape and loop order";
+void transpose_blocked(int M, int N, int A[N][M], int B[M][N], int order, int bh, int bw){
+    int i, j, ii, jj, k;
+    int rows = (N + bh - 1) / bh, cols = (M + bw - 1) / bw;
+    int diag = -1, tmp = 0;
+    if (order == ORDER_QUAD) {
+        transpose_64(M, N, A, B);
+        return;
+    }
+    for (k = 0; k < rows * cols; k++) {
+        ii = (order & ORDER_BLOCK_COLS ? k % rows : k / cols) * bh;
+        jj = (order & ORDER_BLOCK_COLS ? k / rows : k % cols) * bw;
+        if (order & ORDER_COLS) {
+            for (j = jj; j < jj + bw && j < M; j++) {
+                for (i = ii; i < ii + bh && i < N; i++) {
+                    if (i != j) {
+                        ST(B, j, i, LD(A, i, j));
+                    } else {
+                        diag = i;
+                        tmp = LD(A, i, j);
+                    }
+                }
+                if (diag >= 0) {
+                    ST(B, diag, diag, tmp);
+                    diag = -1;
+                }
+            }
+        } else {
+            for (i = ii; i < ii + bh && i < N; i++) {
+                for (j = jj; j < jj + bw && j < M; j++) {
+                    if (i != j) {
+                        ST(B, j, i, LD(A, i, j));
+                    } else {
+                        diag = i;
+                        tmp = LD(A, i, j);
+                    }
+                }
+                if (diag >= 0) {
+                    ST(B, diag, diag, tmp);
+                    diag = -1;
+                }
+            }
+        }
+    }
+}
+
 /* 
  * trans - A simple baseline transpose function, not optimized for the cache.
  */
@@ -223,3 +300,280 @@ int is_transpose(int M, int N, int A[N][M], int B[M][N])
     }
     return 1;
 }
+
+
+#ifdef TRANS_EVAL
+
+/***** In-process evaluation and the autotuner, built with
+    gcc -O2 -DTRANS_EVAL -o trans-tune trans.c csimlib.c cachelab.c
+    ./trans-tune [-s s] [-E E] [-b b] [-o trans_tuned.h] [MxN ...]
+Misses are counted through csimlib on the graded cache (s = 5, E = 1,
+b = 5 unless given) instead of valgrind. The tuned kernels record through
+LD and ST while eval_on is set. trans stays as handed out and has a twin
+that records its loads and stores in the same order. For each shape
+(32x32, 64x64 and 61x67 by default) the tuner tries every block shape from
+1 to 32 on a side in every loop order, plus the quadrant kernel when both
+sides are multiples of 8, and ranks them by misses, then by measured time.
+Every candidate tied on the fewest misses is timed, and among those within
+TIME_TOLERANCE of the fastest the biggest block wins, so timing noise
+doesn't change the table from run to run. The winners go to
+-o as the TUNED table transpose_submit includes. *****/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "csimlib.h"
+
+#define EVAL_BATCH 4096
+#define EVAL_TIME 0.002             // seconds each candidate is timed for, at least
+#define EVAL_RUNS 5                 // timings per candidate, the fastest counts
+#define SHOWN 5                     // candidates printed per shape
+#define MAX_SIDE 32                 // largest block side tried
+#define TIME_TOLERANCE 0.20         // runtimes this close count as a tie
+#define MAX_CANDIDATES (MAX_SIDE * MAX_SIDE * ORDER_QUAD + 1)
+
+typedef struct {
+    int order, bh, bw;
+    int misses;
+    double ns;                      // per element
+} candidate;
+
+static int eval_A[256][256], eval_B[256][256];   // laid out like tracegen's
+static trace_record eval_recs[EVAL_BATCH];
+static int eval_n = 0, eval_on = 0;
+static cache eval_cache;
+static int eval_s = 5, eval_E = 1, eval_b = 5;
+static candidate current;           // what eval_candidate runs
+
+/***** Queue one access, replaying the batch when it is full *****/
+
+static void eval_record(char op, const int *p) {
+    trace_record *rec = &eval_recs[eval_n++];
+    rec->op = op;
+    rec->core = 0;
+    rec->size = sizeof(int);
+    rec->address = (uintptr_t)p;
+    if (eval_n == EVAL_BATCH) {
+        replay_batch(&eval_cache, eval_recs, eval_n, NULL);
+        eval_n = 0;
+    }
+}
+
+int eval_load(const int *p) {
+    if (eval_on)
+        eval_record(LOAD, p);
+    return *p;
+}
+
+void eval_store(int *p, int v) {
+    if (eval_on)
+        eval_record(STORE, p);
+    *p = v;
+}
+
+/***** trans with its accesses recorded *****/
+
+void eval_trans(int M, int N, int A[N][M], int B[M][N])
+{
+    int i, j, tmp;
+
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < M; j++) {
+            eval_record(LOAD, &A[i][j]);
+            tmp = A[i][j];
+            eval_record(STORE, &B[j][i]);
+            B[j][i] = tmp;
+        }
+    }
+}
+
+void eval_candidate(int M, int N, int A[N][M], int B[M][N]) {
+    transpose_blocked(M, N, A, B, current.order, current.bh, current.bw);
+}
+
+/***** Misses of one transpose on a fresh cache, -1 if it got B wrong *****/
+
+int eval_misses(void (*kernel)(int M, int N, int A[N][M], int B[M][N]), int M, int N) {
+    int (*A)[M] = (int (*)[M])eval_A, (*B)[N] = (int (*)[N])eval_B;
+
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < M; j++)
+            A[i][j] = i * M + j;
+    memset(eval_B, 0, sizeof(eval_B));
+    eval_cache = initialize_cache(eval_s, eval_E, eval_b, POLICY_LRU, LAYOUT_AOS);
+    eval_n = 0;
+    eval_on = 1;
+    kernel(M, N, A, B);
+    eval_on = 0;
+    replay_batch(&eval_cache, eval_recs, eval_n, NULL);
+    int misses = eval_cache.misses;
+    free_cache(&eval_cache);
+    return is_transpose(M, N, A, B) ? misses : -1;
+}
+
+/***** Nanoseconds per element of the unrecorded kernel: enough repetitions
+to take EVAL_TIME, measured EVAL_RUNS times, the fastest run counts *****/
+
+double eval_time(void (*kernel)(int M, int N, int A[N][M], int B[M][N]), int M, int N) {
+    struct timespec start, end;
+    double secs, best = 0;
+    long reps = 1;
+    int runs = 0;
+
+    while (runs < EVAL_RUNS) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (long r = 0; r < reps; r++)
+            kernel(M, N, (int (*)[M])eval_A, (int (*)[N])eval_B);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        secs = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (runs == 0 && secs < EVAL_TIME) {
+            reps *= 2;
+            continue;
+        }
+        if (runs++ == 0 || secs < best)
+            best = secs;
+    }
+    return best * 1e9 / reps / (M * N);
+}
+
+/***** Fewest misses first, then fastest, then search order *****/
+
+int compare_candidates(const void *a, const void *b) {
+    const candidate *x = a, *y = b;
+    if (x->misses != y->misses)
+        return x->misses - y->misses;
+    if (x->ns != y->ns)
+        return (x->ns > y->ns) - (x->ns < y->ns);
+    if (x->order != y->order)
+        return x->order - y->order;
+    if (x->bh != y->bh)
+        return x->bh - y->bh;
+    return x->bw - y->bw;
+}
+
+/***** Among candidates that tie on misses and time, the biggest block
+then the lowest order. Big blocks sit well inside the tolerance while the
+small ones are the slow edge of it, so this choice is the stable one. *****/
+
+int preferred(const candidate *x, const candidate *y) {
+    if (x->bh * x->bw != y->bh * y->bw)
+        return x->bh * x->bw > y->bh * y->bw;
+    if (x->order != y->order)
+        return x->order < y->order;
+    return x->bh > y->bh;
+}
+
+const char *order_name(int order) {
+    static const char *names[] = {"row blocks, rows", "row blocks, columns", "column blocks, rows",
+                                  "column blocks, columns", "quadrants"};
+    return names[order];
+}
+
+/***** Score every candidate for an M x N transpose, print the best and the
+kernel transpose_submit used to pick by hand, and add the winner to out *****/
+
+void tune(int M, int N, FILE *out) {
+    static candidate cands[MAX_CANDIDATES];
+    candidate hand = M == 32 && N == 32 ? (candidate){0, 8, 8, 0, 0}
+                   : M == 64 && N == 64 ? (candidate){ORDER_QUAD, 8, 8, 0, 0}
+                   : (candidate){ORDER_BLOCK_COLS, 16, 16, 0, 0};
+    int n = 0, tied, best = 0;
+
+    for (int order = 0; order <= ORDER_QUAD; order++)
+        for (int bh = 1; bh <= MAX_SIDE && bh <= N; bh++)
+            for (int bw = 1; bw <= MAX_SIDE && bw <= M; bw++) {
+                current = (candidate){order, bh, bw, 0, 0};
+                if (order == ORDER_QUAD && (bh != 8 || bw != 8 || M % 8 || N % 8))
+                    continue;
+                if ((current.misses = eval_misses(eval_candidate, M, N)) < 0) {
+                    fprintf(stderr, "Error: %s %dx%d blocks didn't transpose %dx%d\n",
+                            order_name(order), bh, bw, M, N);
+                    continue;
+                }
+                cands[n++] = current;
+                if (order == hand.order && bh == hand.bh && bw == hand.bw)
+                    hand = current;
+            }
+    qsort(cands, n, sizeof(candidate), compare_candidates);
+    for (tied = 0; tied < n && cands[tied].misses == cands[0].misses; tied++)
+        ;
+    for (int k = 0; k < n && (k < tied || k < SHOWN); k++) {
+        current = cands[k];
+        cands[k].ns = eval_time(eval_candidate, M, N);
+    }
+    qsort(cands, tied, sizeof(candidate), compare_candidates);
+    for (int k = 1; k < tied; k++)        // cands[0] is the fastest
+        if (cands[k].ns <= cands[0].ns * (1 + TIME_TOLERANCE) && preferred(&cands[k], &cands[best]))
+            best = k;
+
+    printf("%dx%d on s=%d E=%d b=%d: trans %d misses, hand-picked %s %dx%d %d misses\n", M, N,
+           eval_s, eval_E, eval_b, eval_misses(eval_trans, M, N), order_name(hand.order), hand.bh, hand.bw, hand.misses);
+    for (int k = 0; k < n && k < SHOWN; k++)
+        printf("  %-24s %2dx%-2d %6d misses %7.2f ns/element\n", order_name(cands[k].order),
+               cands[k].bh, cands[k].bw, cands[k].misses, cands[k].ns);
+    if (n > 0)
+        printf("  picked %s %dx%d, %d of %d with the fewest misses within %.0f%% of the fastest\n",
+               order_name(cands[best].order), cands[best].bh, cands[best].bw, best + 1, tied, TIME_TOLERANCE * 100);
+    if (out && n > 0) {
+        char entry[64];
+        snprintf(entry, sizeof(entry), "TUNED(%d, %d, %d, %d, %d)", M, N, cands[best].order, cands[best].bh, cands[best].bw);
+        fprintf(out, "%-28s // %s, %d misses\n", entry, order_name(cands[best].order), cands[best].misses);
+    }
+}
+
+int main(int argc, char **argv) {
+    static const int shapes[][2] = {{32, 32}, {64, 64}, {61, 67}};
+    const char *problem;
+    FILE *out = NULL;
+    int opt, M, N;
+
+    while ((opt = getopt(argc, argv, "s:E:b:o:")) != -1) {
+        switch (opt) {
+        case 's':
+            eval_s = atoi(optarg);
+            break;
+        case 'E':
+            eval_E = atoi(optarg);
+            break;
+        case 'b':
+            eval_b = atoi(optarg);
+            break;
+        case 'o':
+            if ((out = fopen(optarg, "w")) == NULL) {
+                fprintf(stderr, "Error: Couldn't open %s for writing.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s s] [-E E] [-b b] [-o trans_tuned.h] [MxN ...]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((problem = check_cache(eval_s, eval_E, eval_b, POLICY_LRU, LAYOUT_AOS)) != NULL) {
+        fprintf(stderr, "Error: %s\n", problem);
+        exit(EXIT_FAILURE);
+    }
+    if (out)
+        fprintf(out, "/***** Generated by the TRANS_EVAL build of trans.c for s=%d E=%d b=%d:\n"
+                "TUNED(M, N, order, block rows, block columns), the fewest misses and then\n"
+                "the fastest kernel for each shape. Rerun the tuner to change it. *****/\n\n",
+                eval_s, eval_E, eval_b);
+
+    if (optind == argc)
+        for (int k = 0; k < 3; k++)
+            tune(shapes[k][0], shapes[k][1], out);
+    for (int k = optind; k < argc; k++) {
+        if (sscanf(argv[k], "%dx%d", &M, &N) != 2 || M < 1 || N < 1 || M > 256 || N > 256) {
+            fprintf(stderr, "Error: Bad shape %s, expected MxN up to 256x256\n", argv[k]);
+            exit(EXIT_FAILURE);
+        }
+        tune(M, N, out);
+    }
+    if (out)
+        fclose(out);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,7 @@
+/***** Generated by the TRANS_EVAL build of trans.c for s=5 E=1 b=5:
+TUNED(M, N, order, block rows, block columns), the fewest misses and then
+the fastest kernel for each shape. Rerun the tuner to change it. *****/
+
+TUNED(32, 32, 0, 32, 8)      // row blocks, rows, 284 misses
+TUNED(64, 64, 4, 8, 8)       // quadrants, 1168 misses
+TUNED(61, 67, 2, 32, 17)     // column blocks, rows, 1803 misses
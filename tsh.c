@@ -15,6 +15,7 @@ here so the presence of more function calls does not seem to be as much of an is
 previous lab. I also instituted a broader error handling function to cover most situations.
 -******/
 
+#define _GNU_SOURCE         /* pipe2, mkostemp, cpu_set_t */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -23,13 +24,30 @@ previous lab. I also instituted a broader error handling function to cover most
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
 #include <errno.h>
+#include <spawn.h>
 
 /* constants */
 #define MAXLINE    1024   /* max line size */
 #define MAXARGS     128   /* max args on a command line */
 #define MAXJOBS      16   /* max jobs at any point in time */
 #define MAXJID    1<<16   /* max job ID */
+#define MAXCMDS      16   /* max commands in a pipeline */
+#define MAXBATCH    256   /* max batch commands started but not yet printed */
+#define MAXHASH      64   /* max remembered command paths */
+#define DEFPATH "/bin:/usr/bin" /* search path when PATH is unset, as execvp */
+
+/* I/O priority encoding, from linux/ioprio.h */
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS  1
+#define IOPRIO_WHO_PGRP     2
 
 /* Job states */
 #define UNDEF 0 /* undefined */
@@ -51,19 +69,90 @@ previous lab. I also instituted a broader error handling function to cover most
 extern char **environ;      /* defined in libc */
 char prompt[] = "tsh> ";    /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;            /* if true, print additional output */
+int use_spawn = 1;          /* launch with posix_spawn, fork is the fallback */
 pid_t mainpid;              /* to store the process id of the main function */
 int nextjid = 1;            /* next job ID to allocate */
 char sbuf[MAXLINE];         /* for composing sprintf messages */
+volatile sig_atomic_t wait_interrupted = 0; /* ctrl-c with no foreground job */
+
+struct usage_t {            /* Resources used by a job */
+    double utime;           /* user CPU seconds */
+    double stime;           /* system CPU seconds */
+    long maxrss;            /* largest resident set of any stage, KB */
+    long nvcsw;             /* voluntary context switches */
+    long nivcsw;            /* involuntary context switches */
+};
+
+struct sched_t {            /* Scheduling settings of a job */
+    int has_cpus;           /* cpus is set */
+    cpu_set_t cpus;         /* CPU affinity mask */
+    int has_nice;           /* nice is set */
+    int nice;               /* nice level, -20 to 19 */
+    int ioclass;            /* I/O scheduling class, 0 if not set */
+    int iolevel;            /* priority within the class, 0 to 7 */
+};
 
 struct job_t {              /* The job struct */
-    pid_t pid;              /* job PID */
+    pid_t pid;              /* job PID, also the process group ID */
     int jid;                /* job ID [1, 2, ...] */
     int state;              /* UNDEF, BG, FG, or ST */
+    pid_t pids[MAXCMDS];    /* PID of each pipeline stage, 0 once reaped */
+    int nprocs;             /* number of pipeline stages */
+    int nlive;              /* stages not yet reaped */
+    int status;             /* wait status of the last stage */
+    int timed;              /* print the usage when the job finishes */
+    double start;           /* launch time, seconds */
+    struct usage_t usage;   /* resources used by the reaped stages */
+    struct sched_t sched;   /* affinity and priorities set with sched */
+    int outfd;              /* read end of the output capture pipe, or -1 */
+    char *ring;             /* captured output, capture_size bytes, or NULL */
+    long captured;          /* bytes captured so far, the ring keeps the last */
     char cmdline[MAXLINE];  /* command line */
 };
 struct job_t jobs[MAXJOBS]; /* The job list */
 typedef struct job_t job_t; /* We don't want to write struct job_t everytime */
 
+struct hash_t {             /* A remembered command location */
+    char name[MAXLINE];     /* command name as typed */
+    char path[MAXLINE];     /* path found by searching PATH */
+    int hits;               /* times the entry has been used */
+};
+struct hash_t hashes[MAXHASH]; /* The command hash table */
+char *hashed_path = NULL;   /* PATH the hash table was filled under */
+int nexthash = 0;           /* slot to replace when the table is full */
+
+struct stage_t {            /* One command of a pipeline */
+    char **argv;            /* arguments, NULL terminated */
+    char *infile;           /* < redirection, or NULL */
+    char *outfile;          /* > or >> redirection, or NULL */
+    int append;             /* true for >> */
+};
+struct pipeline_t {         /* A parsed command line */
+    struct stage_t stages[MAXCMDS];
+    int nstages;
+    int timed;              /* prefixed with time */
+    struct sched_t sched;   /* settings of a sched prefix */
+};
+
+struct batch_t {            /* A command of a batch run (-j) */
+    char cmdline[MAXLINE];  /* command line */
+    pid_t pid;              /* process group of the command */
+    int done;               /* every stage has been reaped */
+    int status;             /* wait status of the last stage */
+    double start, end;      /* launch and reap times, seconds */
+    int outfd;              /* temporary file holding stdout and stderr */
+};
+struct batch_t batch[MAXBATCH]; /* Batch commands, indexed by sequence % MAXBATCH */
+long capture_size = 0;      /* if nonzero, capture bg output in rings this big */
+char *capture_arena;        /* ring storage, one capture_size slice per job slot */
+
+int batch_jobs = 0;         /* if nonzero, run a batch this many at a time */
+int batch_started = 0;      /* sequence number of the next batch command */
+int batch_printed = 0;      /* sequence number of the next output to print */
+int batch_running = 0;      /* batch commands not yet reaped */
+int batch_failed = 0;       /* printed batch commands with nonzero status */
+double batch_job_time = 0;  /* summed wall time of printed batch commands */
+
 /***** error handler *****/
 typedef enum {
     ERR_NO_ARG,
@@ -71,6 +160,9 @@ typedef enum {
     ERR_NO_SUCH_PROCESS, 
     ERR_INVALID_ID, 
     ERR_NO_CMD,
+    ERR_SYNTAX,
+    ERR_FILE,
+    ERR_BAD_ARG,
     ERR_APP,
     ERR_UNIX
 } ErrorType;
@@ -79,12 +171,20 @@ typedef enum {
 
 void eval(char *cmdline);
 int builtin_cmd(char **argv);
+int builtin_stage(struct stage_t *st);
 void do_bgfg(char **argv);
+void do_sched(char **argv);
+void do_output(char **argv);
+void do_wait(char **argv);
+int wait_jobs(pid_t *pgids, int n, int any);
+int running_jobs(pid_t *pgids);
+struct job_t *find_job(char **argv);
 void waitfg(pid_t pid);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
 void sigint_handler(int sig);
+void sigio_handler(int sig);
 
 int valid_argument(char*);                 
 void arg_list(char* buf, char** argv, int* argc);
@@ -92,20 +192,68 @@ char* process_argument(char* buf, char** argv, int* argc);
 char* arg_delim(char* buf);
 char* skip_spaces(char* buf);
 int parseline(const char *cmdline, char **argv);
+void space_operators(char *dst, const char *src);
+int is_operator(const char *tok);
+int parse_pipeline(char **argv, struct pipeline_t *pl);
 void sigquit_handler(int sig);
-void execute_command(char *argv[], sigset_t *mask, char *cmdline, int bg);
+void execute_command(struct pipeline_t *pl, sigset_t *mask, char *cmdline, int bg);
+pid_t start_job(struct pipeline_t *pl, sigset_t *mask, char *cmdline, int state, int *io);
+int open_stage_fds(struct pipeline_t *pl, int fds[][3], int *io);
+void close_stage_fds(int fds[][3], int n);
+pid_t launch_process(char *path, char *argv[], sigset_t *mask, pid_t pgid, int *fds, struct sched_t *sched);
+int spawn_process(char *path, char *argv[], sigset_t *mask, pid_t pgid, int *fds, pid_t *pid);
+pid_t fork_process(char *path, char *argv[], sigset_t *mask, pid_t pgid, int *fds, struct sched_t *sched);
+int is_exec_error(int err);
+char **shell_argv(char *path, char *argv[], char **buf);
+void no_command(const char *name, int fd);
+void do_hash(char **argv);
 void setup_signal_handlers(sigset_t *mask);
 
+int run_batch(FILE *in, int njobs);
+int is_builtin(char *name);
+void batch_reaped(struct job_t *job);
+void print_batch_output(void);
+int open_tmp(void);
+double now_sec(void);
+
+int parse_sched(char **argv, struct sched_t *sched);
+int parse_cpulist(const char *list, cpu_set_t *cpus);
+int parse_ioprio(const char *spec, int *ioclass, int *iolevel);
+int has_sched(struct sched_t *sched);
+void merge_sched(struct sched_t *dst, struct sched_t *src);
+int apply_sched(pid_t pid, struct sched_t *sched);
+int apply_sched_pgrp(pid_t pgid, struct sched_t *sched);
+void format_sched(struct sched_t *sched, char *buf, int len);
+
+int capture_output(struct job_t *job, int fd);
+void drain_output(struct job_t *job);
+void ring_append(struct job_t *job, const char *buf, long n);
+void print_output(struct job_t *job, int lines);
+
+char *lookup_command(char *name);
+int resolve_command(const char *name, char *path);
+struct hash_t *gethash(const char *name);
+struct hash_t *addhash(const char *name, const char *path);
+void clearhash(void);
+void check_hash_path(void);
+void listhash(void);
+
 void clearjob(struct job_t *job);
 void initjobs(struct job_t *jobs);
 int maxjid(struct job_t *jobs);
 int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
+void addjobproc(struct job_t *job, pid_t pid);
 int deletejob(struct job_t *jobs, pid_t pid);
 pid_t fgpid(struct job_t *jobs);
 struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
 struct job_t *getjobjid(struct job_t *jobs, int jid);
+struct job_t *getjobproc(struct job_t *jobs, pid_t pid, int *stage);
 int pid2jid(pid_t pid);
-void listjobs(struct job_t *jobs);
+void listjobs(struct job_t *jobs, int with_usage);
+void add_rusage(struct usage_t *usage, struct rusage *ru);
+int proc_usage(pid_t pid, struct usage_t *usage);
+void job_usage(struct job_t *job, struct usage_t *usage);
+void print_usage(struct usage_t *usage, double wall);
 
 void usage(void);
 void handle_error(ErrorType err, const char *info);
@@ -125,7 +273,7 @@ int main(int argc, char **argv)
     mainpid = getpid();
     int emit_prompt = 1; 
     dup2(1, 2);
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    while ((c = getopt(argc, argv, "hvpfj:o:")) != EOF) {
         switch (c) {
         case 'h':             
             usage();
@@ -136,6 +284,21 @@ int main(int argc, char **argv)
         case 'p':             
             emit_prompt = 0; 
 	    break;
+        case 'f':
+            use_spawn = 0;
+	    break;
+        case 'j':
+            batch_jobs = atoi(optarg);
+            if (batch_jobs < 1)
+                usage();
+	    break;
+        case 'o':
+            capture_size = atol(optarg) * 1024;
+            if (capture_size < 1)
+                usage();
+            if ((capture_arena = malloc(MAXJOBS * capture_size)) == NULL)
+                handle_error(ERR_UNIX, "malloc error");
+	    break;
 	default:
             usage();
 	}
@@ -144,7 +307,14 @@ int main(int argc, char **argv)
     Signal(SIGTSTP, sigtstp_handler);  
     Signal(SIGCHLD, sigchld_handler);  
     Signal(SIGQUIT, sigquit_handler);
+    Signal(SIGIO,   sigio_handler);
     initjobs(jobs);
+    if (batch_jobs) {
+        FILE *in = stdin;
+        if (optind < argc && (in = fopen(argv[optind], "r")) == NULL)
+            handle_error(ERR_UNIX, argv[optind]);
+        exit(run_batch(in, batch_jobs));
+    }
     while (1) {
 	if (emit_prompt) {
 	    printf("%s", prompt);
@@ -172,20 +342,24 @@ int main(int argc, char **argv)
  * the foreground, wait for it to terminate and then return.  Note:
  * each child process must have a unique process group ID so that our
  * background children don't receive SIGINT (SIGTSTP) from the kernel
- * when we type ctrl-c (ctrl-z) at the keyboard.*/
+ * when we type ctrl-c (ctrl-z) at the keyboard. A pipeline (cmd | cmd)
+ * runs as one job whose stages share a single process group.*/
 
 void eval(char *cmdline) {
     char *argv[MAXARGS];
+    struct pipeline_t pl;
     int bg; 
     sigset_t mask;
 
     bg = parseline(cmdline, argv);
     if (argv[0] == NULL) 
         return;
+    if (parse_pipeline(argv, &pl) < 0)
+        return;
 
-    if (!builtin_cmd(argv)) {  
+    if (pl.nstages > 1 || !builtin_stage(&pl.stages[0])) {  
         setup_signal_handlers(&mask);  
-        execute_command(argv, &mask, cmdline, bg);  
+        execute_command(&pl, &mask, cmdline, bg);  
     }
 }
 
@@ -196,49 +370,312 @@ void eval(char *cmdline) {
 void setup_signal_handlers(sigset_t *mask) {
     if (sigemptyset(mask) < 0)
         handle_error(ERR_UNIX, "sigemptyset error");
-    if (sigaddset(mask, SIGCHLD))
+    if (sigaddset(mask, SIGCHLD) || sigaddset(mask, SIGIO) ||   //ctrl-c/ctrl-z wait until the job is listed
+        sigaddset(mask, SIGINT) || sigaddset(mask, SIGTSTP))
         handle_error(ERR_UNIX, "sigaddset error");
     if (sigprocmask(SIG_BLOCK, mask, NULL) < 0)
         handle_error(ERR_UNIX, "sigprocmask error");
 }
 
-/***** Executing commands that are not built in *****/
+/***** Executing commands that are not built in. Every stage of a pipeline
+is launched into the process group of the first one and the whole pipeline
+becomes a single job, so signals and bg/fg act on all of it. *****/
+
+void execute_command(struct pipeline_t *pl, sigset_t *mask, char *cmdline, int bg) {
+    int io[3] = {-1, -1, -1};
+    int capture[2] = {-1, -1};
+    if (bg && capture_size && pipe2(capture, O_CLOEXEC) < 0)
+        handle_error(ERR_FILE, "pipe");
+    if (capture[0] >= 0 &&              //async before the children can write
+        (fcntl(capture[0], F_SETOWN, getpid()) < 0 ||
+         fcntl(capture[0], F_SETFL, O_NONBLOCK | O_ASYNC) < 0)) {
+        handle_error(ERR_FILE, "fcntl");
+        close(capture[0]);
+        close(capture[1]);
+        capture[0] = capture[1] = -1;
+    }
+    io[1] = io[2] = capture[1];         //-1 unless capturing
+    pid_t pgid = start_job(pl, mask, cmdline, bg ? BG : FG, io);
+    if (capture[1] >= 0) {
+        close(capture[1]);
+        if (pgid == 0 || capture_output(getjobpid(jobs, pgid), capture[0]) < 0)
+            close(capture[0]);
+    }
+    if (pgid != 0 && bg)                //before SIGCHLD can delete the job
+        printf("[%d] (%d) %s", pid2jid(pgid), pgid, cmdline);
+    sigprocmask(SIG_UNBLOCK, mask, NULL);
+    if (pgid == 0)
+        return;
+    //Parent process
+    if (!bg) 
+        waitfg(pgid);
+}
+
+/***** Attach the read end of a capture pipe to a job. The pipe is made
+nonblocking and async before the job starts, so the shell is sent SIGIO
+for the first write too, and sigio_handler copies the output into the
+job's ring, so a busy writer never waits on the terminal. SIGIO is
+blocked until the job has been attached. *****/
+
+int capture_output(job_t *job, int fd) {
+    if (!job)
+        return -1;
+    job->ring = capture_arena + (job - jobs) * capture_size;
+    job->captured = 0;
+    job->outfd = fd;
+    return 0;
+}
+
+/***** Launch every stage of a pipeline and add it to the job list with
+the given state. io holds descriptors for the stdin of the first stage,
+the stdout of the last stage and the stderr of every stage, -1 to inherit
+the shell's. Call with SIGCHLD blocked. Returns the process group of the
+new job, or 0 if nothing was started. *****/
+
+pid_t start_job(struct pipeline_t *pl, sigset_t *mask, char *cmdline, int state, int *io) {
+    char *paths[MAXCMDS];
+    int fds[MAXCMDS][3];
+    pid_t pid, pgid = 0;
+    job_t *job = NULL;
+    int i;
+
+    for (i = 0; i < pl->nstages; i++) {
+        if ((paths[i] = lookup_command(pl->stages[i].argv[0])) == NULL) {
+            no_command(pl->stages[i].argv[0], io[2]);
+            return 0;
+        }
+    }
+    if (open_stage_fds(pl, fds, io) < 0)
+        return 0;
+    for (i = 0; i < pl->nstages; i++) {
+        if ((pid = launch_process(paths[i], pl->stages[i].argv, mask, pgid, fds[i], &pl->sched)) <= 0)
+            break;
+        if (pgid == 0) {
+            pgid = pid;
+            addjob(jobs, pid, state, cmdline);
+            if ((job = getjobpid(jobs, pid)) != NULL) {
+                job->timed = pl->timed;
+                job->sched = pl->sched;
+            }
+        } else if (job) {
+            addjobproc(job, pid);
+        }
+    }
+    close_stage_fds(fds, pl->nstages);
+    return pgid;
+}
+
+/***** Open the pipes and redirection files of a pipeline. fds[i] holds
+the descriptors stage i should get as stdin, stdout and stderr, -1 to
+inherit the shell's. Everything is opened or duplicated close-on-exec, the
+children only keep the copies dup2 makes onto 0, 1 and 2. *****/
+
+int open_stage_fds(struct pipeline_t *pl, int fds[][3], int *io) {
+    struct stage_t *st;
+    int pipefd[2];
+    int i, flags, last = pl->nstages - 1;
+
+    for (i = 0; i < pl->nstages; i++)
+        fds[i][0] = fds[i][1] = fds[i][2] = -1;
+    for (i = 0; i < pl->nstages; i++) {
+        st = &pl->stages[i];
+        if (i == 0 && io[0] >= 0 && !st->infile && (fds[i][0] = fcntl(io[0], F_DUPFD_CLOEXEC, 0)) < 0)
+            break;
+        if (i == last && io[1] >= 0 && !st->outfile && (fds[i][1] = fcntl(io[1], F_DUPFD_CLOEXEC, 0)) < 0)
+            break;
+        if (io[2] >= 0 && (fds[i][2] = fcntl(io[2], F_DUPFD_CLOEXEC, 0)) < 0)
+            break;
+        if (i + 1 < pl->nstages) {
+            if (pipe2(pipefd, O_CLOEXEC) < 0) {
+                handle_error(ERR_FILE, "pipe");
+                break;
+            }
+            fds[i][1] = pipefd[1];
+            fds[i + 1][0] = pipefd[0];
+        }
+        if (st->infile) {
+            if (fds[i][0] >= 0)
+                close(fds[i][0]);
+            if ((fds[i][0] = open(st->infile, O_RDONLY | O_CLOEXEC)) < 0) {
+                handle_error(ERR_FILE, st->infile);
+                break;
+            }
+        }
+        if (st->outfile) {
+            if (fds[i][1] >= 0)
+                close(fds[i][1]);
+            flags = O_WRONLY | O_CREAT | O_CLOEXEC | (st->append ? O_APPEND : O_TRUNC);
+            if ((fds[i][1] = open(st->outfile, flags, 0666)) < 0) {
+                handle_error(ERR_FILE, st->outfile);
+                break;
+            }
+        }
+    }
+    if (i < pl->nstages) {
+        close_stage_fds(fds, pl->nstages);
+        return -1;
+    }
+    return 0;
+}
 
-void execute_command(char *argv[], sigset_t *mask, char *cmdline, int bg) {
+/***** Parent side close of every descriptor handed to the stages *****/
+
+void close_stage_fds(int fds[][3], int n) {
+    int i, j;
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < 3; j++) {
+            if (fds[i][j] >= 0)
+                close(fds[i][j]);
+            fds[i][j] = -1;
+        }
+    }
+}
+
+/*********************************************
+*Helper functions for launching a child process
+*********************************************/
+
+/***** Execute path in process group pgid, or a new group of its own when
+pgid is 0, with fds[0], fds[1] and fds[2] as stdin, stdout and stderr
+when they are not -1.
+posix_spawn is tried first because it avoids copying the page tables of
+the shell, fork is the fallback when spawning is disabled (-f) or fails
+for a reason other than the exec itself. posix_spawn has no attributes
+for affinity or priorities, so a job with sched settings is forked too.
+A file that is not an executable format (ENOEXEC) is run by /bin/sh, as
+execvp did. Returns the child pid, or 0 if the program could not be
+executed. *****/
+
+pid_t launch_process(char *path, char *argv[], sigset_t *mask, pid_t pgid, int *fds, struct sched_t *sched) {
+    char *shargv[MAXARGS + 2];
+    pid_t pid;
+    int err;
+    if (use_spawn && !has_sched(sched)) {
+        if ((err = spawn_process(path, argv, mask, pgid, fds, &pid)) == ENOEXEC)
+            err = spawn_process("/bin/sh", shell_argv(path, argv, shargv), mask, pgid, fds, &pid);
+        if (err == 0)
+            return pid;
+        if (is_exec_error(err)) {
+            no_command(argv[0], fds[2]);
+            return 0;
+        }
+        if (verbose)
+            printf("posix_spawn failed (%s), falling back to fork\n", strerror(err));
+    }
+    return fork_process(path, argv, mask, pgid, fds, sched);
+}
+
+/***** posix_spawn path. SETPGROUP does the setpgid(0, pgid) and
+SETSIGMASK gives the child our mask minus the blocked SIGCHLD, the same
+state the fork child reaches before execve. Redirections become dup2 file
+actions. Returns 0 or an errno value. *****/
+
+int spawn_process(char *path, char *argv[], sigset_t *mask, pid_t pgid, int *fds, pid_t *pid) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions, *actionsp = NULL;
+    sigset_t child_mask;
+    int signum, err;
+
+    if (sigprocmask(SIG_BLOCK, NULL, &child_mask) < 0)
+        return errno;
+    for (signum = 1; signum < NSIG; signum++)
+        if (sigismember(mask, signum) == 1)
+            sigdelset(&child_mask, signum);
+
+    if (fds[0] >= 0 || fds[1] >= 0 || fds[2] >= 0) {
+        if ((err = posix_spawn_file_actions_init(&actions)) != 0)
+            return err;
+        actionsp = &actions;
+        if (fds[0] >= 0 && (err = posix_spawn_file_actions_adddup2(actionsp, fds[0], STDIN_FILENO)) != 0)
+            goto out_actions;
+        if (fds[1] >= 0 && (err = posix_spawn_file_actions_adddup2(actionsp, fds[1], STDOUT_FILENO)) != 0)
+            goto out_actions;
+        if (fds[2] >= 0 && (err = posix_spawn_file_actions_adddup2(actionsp, fds[2], STDERR_FILENO)) != 0)
+            goto out_actions;
+    }
+    if ((err = posix_spawnattr_init(&attr)) != 0)
+        goto out_actions;
+    if ((err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK)) == 0 &&
+        (err = posix_spawnattr_setpgroup(&attr, pgid)) == 0 &&
+        (err = posix_spawnattr_setsigmask(&attr, &child_mask)) == 0)
+        err = posix_spawn(pid, path, actionsp, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+out_actions:
+    if (actionsp)
+        posix_spawn_file_actions_destroy(actionsp);
+    return err;
+}
+
+/***** Original fork path, returns the child pid or 0 on failure. The
+parent also sets the group so a following stage can join it even if this
+child has not run yet. *****/
+
+pid_t fork_process(char *path, char *argv[], sigset_t *mask, pid_t pgid, int *fds, struct sched_t *sched) {
+    char *shargv[MAXARGS + 2];
     pid_t pid;
     if ((pid = fork()) < 0) {
         handle_error(ERR_UNIX, "Forking Error!");
-        return;
+        return 0;
     } else if (pid == 0) {  // Child process
-        setpgid(0, 0);
+        setpgid(0, pgid);
+        if (fds[0] >= 0)
+            dup2(fds[0], STDIN_FILENO);
+        if (fds[1] >= 0)
+            dup2(fds[1], STDOUT_FILENO);
+        if (fds[2] >= 0)
+            dup2(fds[2], STDERR_FILENO);
+        apply_sched(0, sched);
         sigprocmask(SIG_UNBLOCK, mask, NULL);
-        if (execvp(argv[0], argv) < 0) {
+        if (execve(path, argv, environ) < 0) {
+            if (errno == ENOEXEC)
+                execve("/bin/sh", shell_argv(path, argv, shargv), environ);
             handle_error(ERR_NO_CMD, argv[0]);
             exit(1);
         }
-    } else { //Parent process
-        if (!bg) 
-            addjob(jobs, pid, FG, cmdline);
-        else 
-            addjob(jobs, pid, BG, cmdline);
-
-        sigprocmask(SIG_UNBLOCK, mask, NULL);
-        if (!bg) 
-            waitfg(pid);
-        else 
-            printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline);
     }
+    setpgid(pid, pgid ? pgid : pid);
+    return pid;
+}
+
+/***** errors that mean the program itself could not be executed *****/
+
+int is_exec_error(int err) {
+    return err == ENOENT || err == EACCES || err == ENOEXEC ||
+           err == ENOTDIR || err == ELOOP || err == ENAMETOOLONG;
+}
+
+/***** argv for running path as a script with /bin/sh, built in buf, which
+needs room for MAXARGS + 2 pointers *****/
+
+char **shell_argv(char *path, char *argv[], char **buf) {
+    int i;
+    buf[0] = "sh";
+    buf[1] = path;
+    for (i = 1; argv[i] != NULL && i < MAXARGS; i++)
+        buf[i + 1] = argv[i];
+    buf[i + 1] = NULL;
+    return buf;
+}
+
+/***** Report a command that could not be found. A batch job's stderr is
+fd, so the message is printed with the rest of its output in order. *****/
+
+void no_command(const char *name, int fd) {
+    if (batch_jobs && fd >= 0)
+        dprintf(fd, "%s: Command not found\n", name);
+    else
+        handle_error(ERR_NO_CMD, name);
 }
 
 /***** parse the command line *****/
 
 int parseline(const char* cmdline, char** argv) {
-    static char array[MAXLINE];  
+    static char array[3 * MAXLINE];  //room for spaces around operators
     char* buf = array;          
     int argc = 0;                
     int bg;                     
 
-    strcpy(buf, cmdline);
+    space_operators(buf, cmdline);
     buf[strlen(buf) - 1] = ' ';  
     buf = skip_spaces(buf);
     arg_list(buf, argv, &argc);
@@ -300,6 +737,93 @@ void arg_list(char* buf, char** argv, int* argc) {
     argv[*argc] = NULL;
 }
 
+/***** Copy the command line, surrounding unquoted |, <, > and >> with
+spaces so they always come out as arguments of their own *****/
+
+void space_operators(char* dst, const char* src) {
+    int quoted = 0;
+    while (*src) {
+        if (*src == '\'') {
+            quoted = !quoted;
+        } else if (!quoted && (*src == '|' || *src == '<' || *src == '>')) {
+            *dst++ = ' ';
+            *dst++ = *src;
+            if (*src == '>' && src[1] == '>')
+                *dst++ = *++src;
+            *dst++ = ' ';
+            src++;
+            continue;
+        }
+        *dst++ = *src++;
+    }
+    *dst = '\0';
+}
+
+int is_operator(const char* tok) {
+    return strcmp(tok, "|") == 0 || strcmp(tok, "<") == 0 ||
+           strcmp(tok, ">") == 0 || strcmp(tok, ">>") == 0;
+}
+
+/***** Split argv into pipeline stages in place. Each | becomes the NULL
+ending a stage and redirections are moved out of the argument lists.
+A leading time marks the whole pipeline as timed and a leading sched
+with options gives its settings to every stage; a sched naming a job is
+left for builtin_cmd. Returns -1 after reporting a syntax error. *****/
+
+int parse_pipeline(char** argv, struct pipeline_t* pl) {
+    struct stage_t* st;
+    char* tok;
+    int r, w = 0;
+
+    memset(pl, 0, sizeof(*pl));
+    while (argv[0]) {
+        if (strcmp(argv[0], "time") == 0) {
+            pl->timed = 1;
+            argv++;
+        } else if (strcmp(argv[0], "sched") == 0) {
+            if ((r = parse_sched(argv, &pl->sched)) < 0)
+                return -1;
+            if (argv[r] == NULL || valid_argument(argv[r]))
+                break;
+            argv += r;
+        } else {
+            break;
+        }
+    }
+    st = &pl->stages[pl->nstages++];
+    st->argv = argv;
+    for (r = 0; (tok = argv[r]) != NULL; r++) {
+        if (strcmp(tok, "|") == 0) {
+            if (st->argv == &argv[w] || pl->nstages == MAXCMDS) {
+                handle_error(ERR_SYNTAX, tok);
+                return -1;
+            }
+            argv[w++] = NULL;
+            st = &pl->stages[pl->nstages++];
+            st->argv = &argv[w];
+        } else if (is_operator(tok)) {
+            if (argv[r + 1] == NULL || is_operator(argv[r + 1])) {
+                handle_error(ERR_SYNTAX, argv[r + 1] ? argv[r + 1] : "newline");
+                return -1;
+            }
+            if (tok[0] == '<') {
+                st->infile = argv[++r];
+            } else {
+                st->outfile = argv[++r];
+                st->append = (tok[1] == '>');
+            }
+        } else {
+            argv[w++] = tok;
+        }
+    }
+    argv[w] = NULL;
+    if (st->argv[0] == NULL) {
+        handle_error(ERR_SYNTAX, pl->nstages > 1 ? "|" : "newline");
+        return -1;
+    }
+    return 0;
+}
+
 
 /***** builtin_cmd - If the user has typed a built-in command
  then execute it immediately. *****/
@@ -307,35 +831,147 @@ void arg_list(char* buf, char** argv, int* argc) {
 int builtin_cmd(char **argv)
 {
     if(strcmp(argv[0],"quit")==0){              
-        int i;
-        for(i=0;i<MAXJOBS;i++){
-            if(jobs[i].state == BG) {
-                waitfg(jobs[i].pid);
-            }
-        }
+        while (waitpid(-1, NULL, WNOHANG) > 0)     //reap what has exited, never wait for the rest
+            ;
         exit(0);
 	}else if(strcmp(argv[0],"jobs")==0){     
-		listjobs(jobs);
+		listjobs(jobs, argv[1] && strcmp(argv[1],"-l")==0);
 		return 1;
     }else if(strcmp(argv[0],"bg")==0 || strcmp(argv[0],"fg")==0){   
 		do_bgfg(argv);
 		return 1;
+    }else if(strcmp(argv[0],"hash")==0){
+		do_hash(argv);
+		return 1;
+    }else if(strcmp(argv[0],"sched")==0){
+		do_sched(argv);
+		return 1;
+    }else if(strcmp(argv[0],"output")==0){
+		do_output(argv);
+		return 1;
+    }else if(strcmp(argv[0],"wait")==0){
+		do_wait(argv);
+		return 1;
 	}else return 0;                             
 }
 
 
+/***** builtin_stage - Run a builtin with the redirections of its stage.
+ The shell's own stdout is pointed at the > or >> file for the duration
+ and put back after; < is opened only to report a missing file, no
+ builtin reads stdin. Returns 0 if the command is not a builtin. *****/
+
+int builtin_stage(struct stage_t *st)
+{
+    int fd, saved = -1;
+    if (!is_builtin(st->argv[0]))
+        return 0;
+    if (st->infile) {
+        if ((fd = open(st->infile, O_RDONLY | O_CLOEXEC)) < 0) {
+            handle_error(ERR_FILE, st->infile);
+            return 1;
+        }
+        close(fd);
+    }
+    if (st->outfile) {
+        fd = open(st->outfile, O_WRONLY | O_CREAT | O_CLOEXEC | (st->append ? O_APPEND : O_TRUNC), 0666);
+        if (fd < 0) {
+            handle_error(ERR_FILE, st->outfile);
+            return 1;
+        }
+        fflush(stdout);
+        if ((saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0)) < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+            handle_error(ERR_FILE, st->outfile);
+            if (saved >= 0)
+                close(saved);
+            close(fd);
+            return 1;
+        }
+        close(fd);
+    }
+    builtin_cmd(st->argv);
+    if (saved >= 0) {
+        fflush(stdout);
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+    return 1;
+}
+
+/***** is_builtin - True if builtin_cmd would handle the command *****/
+
+int is_builtin(char *name)
+{
+    return strcmp(name,"quit")==0 || strcmp(name,"jobs")==0 || strcmp(name,"bg")==0 ||
+           strcmp(name,"fg")==0 || strcmp(name,"hash")==0 || strcmp(name,"sched")==0 ||
+           strcmp(name,"output")==0 || strcmp(name,"wait")==0;
+}
+
 /***** do_bgfg - Execute the builtin bg and fg commands. *****/
 
 void do_bgfg(char **argv) {
+    job_t* job = find_job(argv);
+    if (!job)
+        return;
+    // Update job state first so a ctrl-c right after the job resumes reaches it
+    int state = job->state;
+    job->state = strcmp(argv[0], "fg") == 0 ? FG : BG;
+    //Continue the job
+    if (kill(-(job->pid), SIGCONT) < 0) {
+        perror("kill (SIGCONT)");
+        job->state = state;
+        return;
+    }
+    // Wait if necessary
+    if (job->state == FG) {
+        waitfg(job->pid);
+    } else {
+        printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
+    }
+}
+
+/***** do_hash - Execute the builtin hash command. With no arguments list
+ the remembered command paths, -r forgets all of them, otherwise look up
+ and remember each named command. *****/
+
+void do_hash(char **argv) {
+    int i;
     if (!argv[1]) {
-        handle_error(ERR_NO_ARG, argv[0]);
+        listhash();
+        return;
+    }
+    if (strcmp(argv[1], "-r") == 0) {
+        clearhash();
         return;
     }
+    for (i = 1; argv[i]; i++) {
+        if (strchr(argv[i], '/'))
+            continue;
+        check_hash_path();
+        struct hash_t *entry = gethash(argv[i]);
+        if (entry && access(entry->path, X_OK) == 0)
+            continue;
+        char path[MAXLINE];
+        if (resolve_command(argv[i], path))
+            addhash(argv[i], path);
+        else
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+    }
+}
+
+/***** find_job - Look up the job named by argv[1], a PID or %jobid,
+ reporting the error for argv[0] if there is none *****/
+
+job_t *find_job(char **argv) {
+    if (!argv[1]) {
+        handle_error(ERR_NO_ARG, argv[0]);
+        return NULL;
+    }
     char *id = argv[1];
     int is_jid = id[0] == '%';
     if (!valid_argument(id)) {
         handle_error(ERR_INVALID_ID, argv[0]);
-        return;
+        return NULL;
     }
     // Determine if we're working with a PID or JID
     int job_number = atoi(id + (is_jid ? 1 : 0));  // Skip '%' for JID
@@ -346,20 +982,130 @@ void do_bgfg(char **argv) {
         } else {
             handle_error(ERR_NO_SUCH_PROCESS, argv[1]);
         }
+    }
+    return job;
+}
+
+/***** do_sched - Execute the builtin sched command on a running job:
+ sched [-c cpus] [-n nice] [-i class[:level]] <PID or %jobid>. The
+ settings apply to the whole process group of the job, with no options
+ the current settings are shown. *****/
+
+void do_sched(char **argv) {
+    struct sched_t sched;
+    int n;
+    memset(&sched, 0, sizeof(sched));
+    if ((n = parse_sched(argv, &sched)) < 0)
+        return;
+    argv[n - 1] = argv[0];              //find_job wants the id in argv[1]
+    job_t *job = find_job(&argv[n - 1]);
+    if (!job)
+        return;
+    if (!has_sched(&sched)) {             //no options, show the settings
+        format_sched(&job->sched, sbuf, MAXLINE);
+        printf("[%d] (%d) %s\n", job->jid, job->pid, sbuf);
         return;
     }
-    //Continue the job
-    if (kill(-(job->pid), SIGCONT) < 0) {
-        perror("kill (SIGCONT)");
+    if (apply_sched_pgrp(job->pid, &sched) == 0)
+        merge_sched(&job->sched, &sched);
+}
+
+/***** do_output - Execute the builtin output command: print what a
+ background job started under -o has written so far, or with -n only its
+ last lines. output [-n lines] <PID or %jobid> *****/
+
+void do_output(char **argv) {
+    sigset_t mask, prev;
+    int lines = 0, n = 0;
+    if (argv[1] && strcmp(argv[1], "-n") == 0) {
+        if (!argv[2] || !valid_argument(argv[2]) || argv[2][0] == '%' || (lines = atoi(argv[2])) < 1) {
+            handle_error(ERR_BAD_ARG, argv[2] ? argv[2] : argv[1]);
+            return;
+        }
+        n = 2;
+        argv[n] = argv[0];                //find_job wants the id in argv[1]
+    }
+    job_t *job = find_job(&argv[n]);
+    if (!job)
+        return;
+    if (!job->ring) {
+        printf("[%d] (%d) output is not captured\n", job->jid, job->pid);
         return;
     }
-    // Update job state and wait if necessary
-    job->state = strcmp(argv[0], "fg") == 0 ? FG : BG;
-    if (job->state == FG) {
-        waitfg(job->pid);
-    } else {
-        printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
+    sigemptyset(&mask);                   //the handlers append to and release the ring
+    sigaddset(&mask, SIGIO);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    drain_output(job);
+    print_output(job, lines);
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+/***** do_wait - Execute the builtin wait command: wait [-n] [PID or
+ %jobid...]. Block until every named job, or every background job if none
+ are named, has finished; with -n until any one of them has. Stopped jobs
+ are not waited for and ctrl-c stops waiting. *****/
+
+void do_wait(char **argv) {
+    pid_t pgids[MAXJOBS];
+    char *id[3] = {argv[0], NULL, NULL};
+    int i = 1, n = 0, any = 0;
+    if (argv[1] && strcmp(argv[1], "-n") == 0) {
+        any = 1;
+        i++;
+    }
+    if (!argv[i]) {
+        wait_jobs(pgids, running_jobs(pgids), any);
+        return;
+    }
+    for (; argv[i] && n < MAXJOBS; i++) {
+        id[1] = argv[i];
+        job_t *job = find_job(id);
+        if (job && job->state == BG)
+            pgids[n++] = job->pid;
+    }
+    wait_jobs(pgids, n, any);
+}
+
+/***** running_jobs - Fill pgids with the background jobs, return how many *****/
+
+int running_jobs(pid_t *pgids) {
+    int i, n = 0;
+    for (i = 0; i < MAXJOBS; i++)
+        if (jobs[i].state == BG)
+            pgids[n++] = jobs[i].pid;
+    return n;
+}
+
+/***** wait_jobs - Sleep in sigsuspend until all of the n jobs, or with any
+ set one of them, have been reaped or stopped. sigchld_handler updates the
+ job list while we sleep so there is no polling. Returns the number of jobs
+ still running, nonzero only if ctrl-c interrupted the wait. *****/
+
+int wait_jobs(pid_t *pgids, int n, int any) {
+    sigset_t mask, prev, wake;
+    int i, left = n;
+    sigemptyset(&mask);                   //ctrl-c between the check and sigsuspend must wake us
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTSTP);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    wake = prev;
+    sigdelset(&wake, SIGCHLD);
+    sigdelset(&wake, SIGINT);
+    sigdelset(&wake, SIGTSTP);
+    wait_interrupted = 0;
+    while (1) {
+        job_t *job;
+        for (i = left = 0; i < n; i++)
+            if ((job = getjobpid(jobs, pgids[i])) != NULL && job->state == BG)
+                left++;
+        if (left == 0 || (any && left < n) || wait_interrupted)
+            break;
+        sigsuspend(&wake);
     }
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return left;
 }
 
 /***** determine if the argument is a number *****/
@@ -383,13 +1129,489 @@ int valid_argument(char *tmp){
 
 void waitfg(pid_t pid)          
 {
-    job_t* temp = getjobpid(jobs,pid);
-    while(temp->state == FG){
-        sleep(1);
+    job_t* temp;
+    sigset_t mask, prev, wake;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &prev);                               //check and sleep without missing a SIGCHLD
+    wake = prev;
+    sigdelset(&wake, SIGCHLD);
+    while((temp = getjobpid(jobs,pid)) != NULL && temp->state == FG){   //job may already be reaped
+        sigsuspend(&wake);                                              //woken by sigchld_handler
     }
+    sigprocmask(SIG_SETMASK, &prev, NULL);
     return;
 }
 
+/*************************
+ * Batch mode (-j)
+ *************************/
+
+/*
+ * run_batch - Run the command lines read from in as background jobs,
+ *     keeping up to njobs of them running. Each job writes stdout and
+ *     stderr to its own temporary file, which is printed in input order
+ *     once the job and every job before it have finished, followed by
+ *     the exit status if it was not 0. Jobs are numbered in the order
+ *     they were started, builtins and blank lines are not counted. Jobs
+ *     are reaped by sigchld_handler and a job that stops is continued,
+ *     the loop only sleeps in sigsuspend until a slot frees up. A builtin
+ *     waits for every earlier job before it runs. Returns the exit status
+ *     of the shell: 0 if every command succeeded, 1 otherwise.
+ */
+int run_batch(FILE *in, int njobs)
+{
+    char cmdline[MAXLINE];
+    char *argv[MAXARGS];
+    struct pipeline_t pl;
+    struct batch_t *slot;
+    sigset_t mask, prev;
+    double wall;
+    int io[3], len;
+
+    if (njobs > MAXJOBS)
+        njobs = MAXJOBS;
+    wall = now_sec();
+    if ((io[0] = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0)
+        handle_error(ERR_UNIX, "/dev/null");
+    setup_signal_handlers(&mask);
+    sigprocmask(SIG_BLOCK, NULL, &prev);
+    sigdelset(&prev, SIGCHLD);
+    sigdelset(&prev, SIGINT);
+    sigdelset(&prev, SIGTSTP);
+
+    while (fgets(cmdline, MAXLINE, in) != NULL) {
+        len = strlen(cmdline);
+        if (len == MAXLINE - 1 && cmdline[len - 1] != '\n')
+            len--;                    //make room for the newline parseline expects
+        if (len == 0 || cmdline[len - 1] != '\n')
+            strcpy(&cmdline[len], "\n");
+        parseline(cmdline, argv);
+        if (argv[0] == NULL || parse_pipeline(argv, &pl) < 0)
+            continue;
+        if (pl.nstages == 1 && is_builtin(pl.stages[0].argv[0])) {
+            while (batch_running > 0)
+                sigsuspend(&prev);
+            print_batch_output();
+            sigprocmask(SIG_SETMASK, &prev, NULL);
+            builtin_stage(&pl.stages[0]);
+            fflush(stdout);
+            sigprocmask(SIG_BLOCK, &mask, NULL);
+            continue;
+        }
+        while (batch_running >= njobs || batch_started - batch_printed >= MAXBATCH) {
+            sigsuspend(&prev);
+            print_batch_output();
+        }
+        slot = &batch[batch_started % MAXBATCH];
+        strcpy(slot->cmdline, cmdline);
+        slot->outfd = io[1] = io[2] = open_tmp();
+        slot->start = slot->end = now_sec();
+        slot->done = 0;
+        fflush(stdout);
+        if ((slot->pid = start_job(&pl, &mask, cmdline, BG, io)) == 0) {
+            slot->done = 1;
+            slot->status = 127 << 8;     //as a shell reports a command that could not run
+        } else {
+            batch_running++;
+        }
+        batch_started++;
+        print_batch_output();
+    }
+    while (batch_running > 0) {
+        sigsuspend(&prev);
+        print_batch_output();
+    }
+    print_batch_output();
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    wall = now_sec() - wall;
+    close(io[0]);
+
+    printf("Batch: %d commands, %d failed, %d at a time, wall %.3fs, job time %.3fs\n",
+           batch_started, batch_failed, njobs, wall, batch_job_time);
+    fflush(stdout);
+    return batch_failed != 0;
+}
+
+/*
+ * batch_reaped - Called by sigchld_handler when every stage of a batch
+ *     job has been reaped, records its status and finish time
+ */
+void batch_reaped(struct job_t *job)
+{
+    int i;
+    for (i = batch_printed; i < batch_started; i++) {
+        struct batch_t *slot = &batch[i % MAXBATCH];
+        if (!slot->done && slot->pid == job->pid) {
+            slot->done = 1;
+            slot->status = job->status;
+            slot->end = now_sec();
+            batch_running--;
+            return;
+        }
+    }
+}
+
+/*
+ * print_batch_output - Print the output of finished batch commands that
+ *     have no unfinished command before them. Call with SIGCHLD blocked.
+ */
+void print_batch_output(void)
+{
+    struct batch_t *slot;
+    char buf[8192];
+    ssize_t n;
+
+    fflush(stdout);
+    while (batch_printed < batch_started && batch[batch_printed % MAXBATCH].done) {
+        slot = &batch[batch_printed % MAXBATCH];
+        if (slot->outfd >= 0) {
+            lseek(slot->outfd, 0, SEEK_SET);
+            while ((n = read(slot->outfd, buf, sizeof(buf))) > 0)
+                if (write(STDOUT_FILENO, buf, n) < 0)
+                    break;
+            close(slot->outfd);
+            slot->outfd = -1;
+        }
+        if (WIFEXITED(slot->status) && WEXITSTATUS(slot->status) != 0)
+            printf("Job [%d] exited with status %d: %s", batch_printed + 1, WEXITSTATUS(slot->status), slot->cmdline);
+        else if (WIFSIGNALED(slot->status))
+            printf("Job [%d] terminated by signal %d: %s", batch_printed + 1, WTERMSIG(slot->status), slot->cmdline);
+        fflush(stdout);
+        batch_failed += slot->status != 0;
+        batch_job_time += slot->end - slot->start;
+        batch_printed++;
+    }
+}
+
+/* open_tmp - Open an unnamed close-on-exec temporary file */
+int open_tmp(void)
+{
+    char name[] = "/tmp/tshXXXXXX";
+    int fd = mkostemp(name, O_CLOEXEC);
+    if (fd < 0)
+        handle_error(ERR_UNIX, "mkostemp error");
+    unlink(name);
+    return fd;
+}
+
+/* now_sec - Monotonic clock in seconds, safe to call from a handler */
+double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*************************
+ * Job scheduling settings
+ *************************/
+
+/*
+ * parse_sched - Parse the options of sched, starting at argv[1], into
+ *     sched. Returns the index of the first argument after the options,
+ *     or -1 after reporting a bad option.
+ */
+int parse_sched(char **argv, struct sched_t *sched)
+{
+    int i;
+    char *end;
+    for (i = 1; argv[i] && argv[i][0] == '-'; i += 2) {
+        if (strlen(argv[i]) != 2 || argv[i + 1] == NULL) {
+            handle_error(ERR_BAD_ARG, argv[i]);
+            return -1;
+        }
+        switch (argv[i][1]) {
+        case 'c':
+            if (parse_cpulist(argv[i + 1], &sched->cpus) < 0) {
+                handle_error(ERR_BAD_ARG, argv[i + 1]);
+                return -1;
+            }
+            sched->has_cpus = 1;
+            break;
+        case 'n':
+            sched->nice = strtol(argv[i + 1], &end, 10);
+            if (*end != '\0' || sched->nice < -20 || sched->nice > 19) {
+                handle_error(ERR_BAD_ARG, argv[i + 1]);
+                return -1;
+            }
+            sched->has_nice = 1;
+            break;
+        case 'i':
+            if (parse_ioprio(argv[i + 1], &sched->ioclass, &sched->iolevel) < 0) {
+                handle_error(ERR_BAD_ARG, argv[i + 1]);
+                return -1;
+            }
+            break;
+        default:
+            handle_error(ERR_BAD_ARG, argv[i]);
+            return -1;
+        }
+    }
+    return i;
+}
+
+/* parse_cpulist - Parse a CPU list such as 0-3,6 */
+int parse_cpulist(const char *list, cpu_set_t *cpus)
+{
+    long first, last;
+    char *end;
+
+    CPU_ZERO(cpus);
+    while (*list) {
+        first = last = strtol(list, &end, 10);
+        if (end == list)
+            return -1;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list)
+                return -1;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+            return -1;
+        for (; first <= last; first++)
+            CPU_SET(first, cpus);
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        list = end;
+    }
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+/* parse_ioprio - Parse an I/O priority: rt[:level], be[:level] or idle */
+int parse_ioprio(const char *spec, int *ioclass, int *iolevel)
+{
+    const char *level = strchr(spec, ':');
+    int len = level ? (int)(level - spec) : (int)strlen(spec);
+
+    if (len == 2 && strncmp(spec, "rt", 2) == 0)
+        *ioclass = 1;
+    else if (len == 2 && strncmp(spec, "be", 2) == 0)
+        *ioclass = 2;
+    else if (len == 4 && strncmp(spec, "idle", 4) == 0 && !level)
+        *ioclass = 3;
+    else
+        return -1;
+    *iolevel = 4;
+    if (level) {
+        if (!isdigit(level[1]) || level[2] != '\0' || level[1] > '7')
+            return -1;
+        *iolevel = level[1] - '0';
+    }
+    if (*ioclass == 3)
+        *iolevel = 0;
+    return 0;
+}
+
+/* has_sched - True if any setting is present */
+int has_sched(struct sched_t *sched)
+{
+    return sched->has_cpus || sched->has_nice || sched->ioclass;
+}
+
+/* merge_sched - Record the settings of src that are present on dst */
+void merge_sched(struct sched_t *dst, struct sched_t *src)
+{
+    if (src->has_cpus) {
+        dst->has_cpus = 1;
+        dst->cpus = src->cpus;
+    }
+    if (src->has_nice) {
+        dst->has_nice = 1;
+        dst->nice = src->nice;
+    }
+    if (src->ioclass) {
+        dst->ioclass = src->ioclass;
+        dst->iolevel = src->iolevel;
+    }
+}
+
+/*
+ * apply_sched - Apply the settings to process pid, 0 for the caller.
+ *     Runs in the child between fork and exec, so failures only warn.
+ */
+int apply_sched(pid_t pid, struct sched_t *sched)
+{
+    int rc = 0;
+    if (sched->has_cpus && sched_setaffinity(pid, sizeof(cpu_set_t), &sched->cpus) < 0) {
+        handle_error(ERR_FILE, "sched_setaffinity");
+        rc = -1;
+    }
+    if (sched->has_nice && setpriority(PRIO_PROCESS, pid, sched->nice) < 0) {
+        handle_error(ERR_FILE, "setpriority");
+        rc = -1;
+    }
+    if (sched->ioclass && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid,
+                                  sched->ioclass << IOPRIO_CLASS_SHIFT | sched->iolevel) < 0) {
+        handle_error(ERR_FILE, "ioprio_set");
+        rc = -1;
+    }
+    return rc;
+}
+
+/*
+ * apply_sched_pgrp - Apply the settings to every process of a process
+ *     group. Priorities have group-wide calls; affinity is per thread, so
+ *     the threads of the group are found through /proc.
+ */
+int apply_sched_pgrp(pid_t pgid, struct sched_t *sched)
+{
+    char path[MAXLINE], line[MAXLINE], *p;
+    struct dirent *proc, *task;
+    DIR *procdir, *taskdir;
+    pid_t pgrp;
+    FILE *f;
+    int rc = 0;
+
+    if (sched->has_nice && setpriority(PRIO_PGRP, pgid, sched->nice) < 0) {
+        handle_error(ERR_FILE, "setpriority");
+        rc = -1;
+    }
+    if (sched->ioclass && syscall(SYS_ioprio_set, IOPRIO_WHO_PGRP, pgid,
+                                  sched->ioclass << IOPRIO_CLASS_SHIFT | sched->iolevel) < 0) {
+        handle_error(ERR_FILE, "ioprio_set");
+        rc = -1;
+    }
+    if (!sched->has_cpus)
+        return rc;
+    if ((procdir = opendir("/proc")) == NULL) {
+        handle_error(ERR_FILE, "/proc");
+        return -1;
+    }
+    while ((proc = readdir(procdir)) != NULL) {
+        if (!isdigit(proc->d_name[0]))
+            continue;
+        snprintf(path, sizeof(path), "/proc/%s/stat", proc->d_name);
+        if ((f = fopen(path, "r")) == NULL)
+            continue;
+        pgrp = 0;
+        if (fgets(line, sizeof(line), f) && (p = strrchr(line, ')')) != NULL)
+            sscanf(p + 2, "%*c %*d %d", &pgrp);
+        fclose(f);
+        if (pgrp != pgid)
+            continue;
+        snprintf(path, sizeof(path), "/proc/%s/task", proc->d_name);
+        if ((taskdir = opendir(path)) == NULL)
+            continue;
+        while ((task = readdir(taskdir)) != NULL) {
+            if (isdigit(task->d_name[0]) &&
+                sched_setaffinity(atoi(task->d_name), sizeof(cpu_set_t), &sched->cpus) < 0 && errno != ESRCH) {
+                handle_error(ERR_FILE, "sched_setaffinity");
+                rc = -1;
+            }
+        }
+        closedir(taskdir);
+    }
+    closedir(procdir);
+    return rc;
+}
+
+/* format_sched - Describe the settings that are present, for listjobs */
+void format_sched(struct sched_t *sched, char *buf, int len)
+{
+    static const char *classes[] = {"none", "rt", "be", "idle"};
+    int n = 0, cpu, last;
+
+    buf[0] = '\0';
+    if (sched->has_cpus) {
+        n += snprintf(buf + n, len - n, "cpus ");
+        for (cpu = 0; cpu < CPU_SETSIZE && n < len; cpu++) {
+            if (!CPU_ISSET(cpu, &sched->cpus))
+                continue;
+            for (last = cpu; last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &sched->cpus); last++)
+                ;
+            if (last > cpu)
+                n += snprintf(buf + n, len - n, "%d-%d,", cpu, last);
+            else
+                n += snprintf(buf + n, len - n, "%d,", cpu);
+            cpu = last;
+        }
+        if (n < len)
+            buf[n - 1] = ' ';        //replace the trailing comma
+    }
+    if (sched->has_nice && n < len)
+        n += snprintf(buf + n, len - n, "nice %d ", sched->nice);
+    if (sched->ioclass == 3 && n < len)
+        n += snprintf(buf + n, len - n, "io idle ");
+    else if (sched->ioclass && n < len)
+        n += snprintf(buf + n, len - n, "io %s:%d ", classes[sched->ioclass], sched->iolevel);
+}
+
+/***************************
+ * Background output capture
+ ***************************/
+
+/*
+ * drain_output - Move everything that can be read without blocking from
+ *     a job's capture pipe into its ring. The pipe is closed at end of
+ *     file, the ring stays until the job is deleted.
+ */
+void drain_output(struct job_t *job)
+{
+    char buf[4096];
+    ssize_t n;
+    while (job->outfd >= 0) {
+        n = read(job->outfd, buf, sizeof(buf));
+        if (n > 0) {
+            ring_append(job, buf, n);
+        } else if (n == 0 || errno != EINTR) {
+            if (n == 0) {
+                close(job->outfd);
+                job->outfd = -1;
+            }
+            break;                        //EAGAIN, nothing more for now
+        }
+    }
+}
+
+/* ring_append - Add bytes to a job's ring, overwriting the oldest */
+void ring_append(struct job_t *job, const char *buf, long n)
+{
+    long pos, chunk;
+    if (n > capture_size) {               //only the tail can survive
+        job->captured += n - capture_size;
+        buf += n - capture_size;
+        n = capture_size;
+    }
+    while (n > 0) {
+        pos = job->captured % capture_size;
+        chunk = capture_size - pos < n ? capture_size - pos : n;
+        memcpy(job->ring + pos, buf, chunk);
+        job->captured += chunk;
+        buf += chunk;
+        n -= chunk;
+    }
+}
+
+/* print_output - Write a job's ring to stdout, all of it or the last lines */
+void print_output(struct job_t *job, int lines)
+{
+    long start = job->captured > capture_size ? job->captured - capture_size : 0;
+    long from = start, pos, chunk;
+    int seen = 0;
+
+    if (lines > 0) {                      //walk back over the last lines
+        for (pos = job->captured - 1; pos >= start; pos--) {
+            if (job->ring[pos % capture_size] == '\n' && pos != job->captured - 1 && ++seen == lines)
+                break;
+        }
+        from = pos + 1;
+    } else if (start > 0) {
+        printf("[%d] (%d) %ld earlier bytes dropped\n", job->jid, job->pid, start);
+    }
+    fflush(stdout);
+    for (pos = from; pos < job->captured; pos += chunk) {
+        chunk = capture_size - pos % capture_size;
+        if (chunk > job->captured - pos)
+            chunk = job->captured - pos;
+        if (write(STDOUT_FILENO, job->ring + pos % capture_size, chunk) < 0)
+            break;
+    }
+}
+
 /*****************
  * Signal handlers
  *****************/
@@ -404,24 +1626,67 @@ void waitfg(pid_t pid)
 void sigchld_handler(int sig)
 {
     pid_t pid;
-    int status;
+    int status, stage;
+    struct rusage ru;
+    sigset_t mask, prev;
+    sigemptyset(&mask);                                     //deletejob releases rings sigio_handler fills
+    sigaddset(&mask, SIGIO);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
     while (1) { 
-       pid = waitpid(-1, &status, WNOHANG | WUNTRACED);     //non blocking wait
-       job_t* temp = getjobpid(jobs,pid); 
+       pid = wait4(-1, &status, WNOHANG | WUNTRACED, &ru);  //non blocking wait, also collects resource usage
        if (pid <= 0)  break;                                // No more zombie children to reap.
-       else{
-        if(WIFEXITED(status)){                          //if child exited normally then delete the job
-            temp->state = UNDEF;
-            deletejob(jobs,pid);
-        }else if(WIFSIGNALED(status)){                       //if child was sent a termination signal then display the message and delete the job
-            printf("Job [%d] (%d) terminated by signal %d\n",pid2jid(pid),pid,WTERMSIG(status));
-            if(temp->state == FG) deletejob(jobs,pid);
-        }else if(WIFSTOPPED(status)){                           //if child was stopped then change it's status to stopped
+       job_t* temp = getjobproc(jobs, pid, &stage);
+       if (temp == NULL) continue;
+       if(WIFSTOPPED(status) && batch_jobs){                //nothing can bg a batch job, so resume it
+            kill(-temp->pid, SIGCONT);
+            continue;
+       }
+       if(WIFSTOPPED(status)){                              //if a stage was stopped then the whole job is, report it once
+            if(temp->state != ST)
+                printf("Job [%d] (%d) stopped by signal %d\n",temp->jid,temp->pid,WSTOPSIG(status));
             temp->state = ST;
-            printf("Job [%d] (%d) stopped by signal %d\n",pid2jid(pid),pid,WSTOPSIG(status));
-        }
+            continue;
+       }
+       add_rusage(&temp->usage, &ru);
+       if(stage == temp->nprocs - 1){                       //a job's status is that of its last stage
+            temp->status = status;
+            if(WIFSIGNALED(status) && !batch_jobs)          //batch mode reports it with the job's output
+                printf("Job [%d] (%d) terminated by signal %d\n",temp->jid,temp->pid,WTERMSIG(status));
+       }
+       temp->pids[stage] = 0;
+       if(--temp->nlive == 0){                              //delete the job once every stage has been reaped
+            if(temp->timed){
+                printf("[%d] (%d) ",temp->jid,temp->pid);
+                print_usage(&temp->usage, now_sec() - temp->start);
+                printf("\n");
+            }
+            if(batch_jobs)
+                batch_reaped(temp);
+            temp->state = UNDEF;
+            deletejob(jobs,temp->pid);
        }
     }
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return;
+}
+
+/*
+ * sigio_handler - The kernel sends a SIGIO to the shell when a captured
+ *     background job has written output. Drain every capture pipe into
+ *     its ring without blocking.
+ */
+void sigio_handler(int sig)
+{
+    int i, olderrno = errno;
+    sigset_t mask, prev;
+    sigemptyset(&mask);                   //sigchld_handler may release a ring
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &prev);
+    for (i = 0; i < MAXJOBS; i++)
+        if (jobs[i].outfd >= 0)
+            drain_output(&jobs[i]);
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    errno = olderrno;
     return;
 }
 
@@ -434,6 +1699,7 @@ void sigint_handler(int sig)
 {
     int pid = fgpid(jobs);
     if(pid!=0) kill(-pid,SIGINT);                  //send sigint to the process group
+    else wait_interrupted = 1;                     //stop the wait builtin
     return;
 }
 
@@ -462,6 +1728,17 @@ void clearjob(struct job_t *job) {
     job->pid = 0;
     job->jid = 0;
     job->state = UNDEF;
+    memset(job->pids, 0, sizeof(job->pids));
+    job->nprocs = 0;
+    job->nlive = 0;
+    job->status = 0;
+    job->timed = 0;
+    memset(&job->sched, 0, sizeof(job->sched));
+    job->outfd = -1;
+    job->ring = NULL;
+    job->captured = 0;
+    job->start = 0;
+    memset(&job->usage, 0, sizeof(job->usage));
     job->cmdline[0] = '\0';
 }
 
@@ -493,6 +1770,9 @@ int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline)
 	    if (jobs[i].pid == 0) {
 	        jobs[i].pid = pid;
 	        jobs[i].state = state;
+	        jobs[i].pids[0] = pid;
+	        jobs[i].nprocs = jobs[i].nlive = 1;
+	        jobs[i].start = now_sec();
 	        jobs[i].jid = nextjid++;
 	        if (nextjid > MAXJOBS)
 		    nextjid = 1;
@@ -507,6 +1787,15 @@ int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline)
     return 0;
 }
 
+/* addjobproc - Add a further pipeline stage to a job */
+void addjobproc(struct job_t *job, pid_t pid)
+{
+    if (job->nprocs < MAXCMDS) {
+        job->pids[job->nprocs++] = pid;
+        job->nlive++;
+    }
+}
+
 /* deletejob - Delete a job whose PID=pid from the job list */
 int deletejob(struct job_t *jobs, pid_t pid)
 {
@@ -515,6 +1804,8 @@ int deletejob(struct job_t *jobs, pid_t pid)
 	return 0;
     for (i = 0; i < MAXJOBS; i++) {
 	    if (jobs[i].pid == pid) {
+	        if (jobs[i].outfd >= 0)
+	            close(jobs[i].outfd);     //release the captured output
 	        clearjob(&jobs[i]);
 	        nextjid = maxjid(jobs)+1;
 	        return 1;
@@ -555,6 +1846,21 @@ struct job_t *getjobjid(struct job_t *jobs, int jid)
     return NULL;
 }
 
+/* getjobproc - Find the job owning process pid and the stage it runs */
+struct job_t *getjobproc(struct job_t *jobs, pid_t pid, int *stage)
+{
+    int i, j;
+    if (pid < 1)
+	return NULL;
+    for (i = 0; i < MAXJOBS; i++)
+	for (j = 0; j < jobs[i].nprocs; j++)
+	    if (jobs[i].pids[j] == pid) {
+		*stage = j;
+		return &jobs[i];
+	    }
+    return NULL;
+}
+
 /* pid2jid - Map process ID to job ID */
 int pid2jid(pid_t pid)
 {
@@ -568,9 +1874,10 @@ int pid2jid(pid_t pid)
     return 0;
 }
 
-/* listjobs - Print the job list */
-void listjobs(struct job_t *jobs)
+/* listjobs - Print the job list, with resource usage for jobs -l */
+void listjobs(struct job_t *jobs, int with_usage)
 {
+    struct usage_t usage;
     int i;
     for (i = 0; i < MAXJOBS; i++) {
 	    if (jobs[i].pid != 0) {
@@ -589,15 +1896,226 @@ void listjobs(struct job_t *jobs)
 		        printf("listjobs: Internal error: job[%d].state=%d ",
 			    i, jobs[i].state);
 	        }
+	        if (has_sched(&jobs[i].sched)) {
+		        format_sched(&jobs[i].sched, sbuf, MAXLINE);
+		        printf("%s", sbuf);
+	        }
+	        if (with_usage) {
+		        job_usage(&jobs[i], &usage);
+		        print_usage(&usage, now_sec() - jobs[i].start);
+		        printf(" ");
+		        if (jobs[i].ring)
+		            printf("output %ldB ", jobs[i].captured);
+	        }
 	        printf("%s", jobs[i].cmdline);
 	    }
     }
 }
+/* add_rusage - Add the usage of a reaped process to a job's total */
+void add_rusage(struct usage_t *usage, struct rusage *ru)
+{
+    usage->utime += ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6;
+    usage->stime += ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+    if (ru->ru_maxrss > usage->maxrss)
+	usage->maxrss = ru->ru_maxrss;
+    usage->nvcsw += ru->ru_nvcsw;
+    usage->nivcsw += ru->ru_nivcsw;
+}
+
+/*
+ * proc_usage - Add the usage so far of a live process, read from /proc.
+ *     Returns 0 if the process is gone or /proc is not available.
+ */
+int proc_usage(pid_t pid, struct usage_t *usage)
+{
+    char path[64], line[MAXLINE], *p;
+    unsigned long utime, stime;
+    long value, ticks = sysconf(_SC_CLK_TCK);
+    FILE *f;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if ((f = fopen(path, "r")) == NULL)
+	return 0;
+    if (!fgets(line, sizeof(line), f) || (p = strrchr(line, ')')) == NULL ||
+	sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+	fclose(f);
+	return 0;
+    }
+    fclose(f);
+    usage->utime += (double)utime / ticks;
+    usage->stime += (double)stime / ticks;
+
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    if ((f = fopen(path, "r")) == NULL)
+	return 1;
+    while (fgets(line, sizeof(line), f)) {
+	if (sscanf(line, "VmHWM: %ld", &value) == 1 && value > usage->maxrss)
+	    usage->maxrss = value;
+	else if (sscanf(line, "voluntary_ctxt_switches: %ld", &value) == 1)
+	    usage->nvcsw += value;
+	else if (sscanf(line, "nonvoluntary_ctxt_switches: %ld", &value) == 1)
+	    usage->nivcsw += value;
+    }
+    fclose(f);
+    return 1;
+}
+
+/* job_usage - Usage of the reaped stages of a job plus its live ones */
+void job_usage(struct job_t *job, struct usage_t *usage)
+{
+    int i;
+    *usage = job->usage;
+    for (i = 0; i < job->nprocs; i++)
+	if (job->pids[i] != 0)
+	    proc_usage(job->pids[i], usage);
+}
+
+/* print_usage - Print wall time and resource usage on the current line */
+void print_usage(struct usage_t *usage, double wall)
+{
+    printf("real %.3fs user %.3fs sys %.3fs maxrss %ldKB csw %ld/%ld",
+	   wall, usage->utime, usage->stime, usage->maxrss, usage->nvcsw, usage->nivcsw);
+}
 /******************************
  * end job list helper routines
  ******************************/
 
 
+/*****************************************************
+ * Helper routines that manipulate the command hash table
+ *****************************************************/
+
+/*
+ * lookup_command - Return the path to execute for a command name. Names
+ *     containing a slash are used as is. Otherwise the hash table is
+ *     consulted first and PATH is only searched on a miss, or when the
+ *     remembered file is no longer executable. Returns NULL if not found.
+ */
+char *lookup_command(char *name)
+{
+    struct hash_t *entry;
+    char path[MAXLINE];
+
+    if (strchr(name, '/'))
+        return name;
+    check_hash_path();
+    if ((entry = gethash(name)) != NULL) {
+        if (access(entry->path, X_OK) == 0) {
+            entry->hits++;
+            return entry->path;
+        }
+        entry->name[0] = '\0';     //stale entry, search again
+    }
+    if (!resolve_command(name, path))
+        return NULL;
+    entry = addhash(name, path);
+    entry->hits++;
+    return entry->path;
+}
+
+/* resolve_command - Search PATH for an executable regular file, as execvp */
+int resolve_command(const char *name, char *path)
+{
+    const char *dirs = getenv("PATH");
+    const char *dir, *end;
+    struct stat st;
+    int len;
+
+    if (dirs == NULL)
+        dirs = DEFPATH;
+    for (dir = dirs; ; dir = end + 1) {
+        end = strchr(dir, ':');
+        len = end ? (int)(end - dir) : (int)strlen(dir);
+        if (len == 0)                //empty element means the current directory
+            snprintf(path, MAXLINE, "%s", name);
+        else
+            snprintf(path, MAXLINE, "%.*s/%s", len, dir, name);
+        if (access(path, X_OK) == 0 && stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            return 1;
+        if (!end)
+            return 0;
+    }
+}
+
+/* gethash - Find a command on the hash table */
+struct hash_t *gethash(const char *name)
+{
+    int i;
+    for (i = 0; i < MAXHASH; i++)
+	if (hashes[i].name[0] != '\0' && strcmp(hashes[i].name, name) == 0)
+	    return &hashes[i];
+    return NULL;
+}
+
+/* addhash - Remember a command path, replacing the oldest slot when full */
+struct hash_t *addhash(const char *name, const char *path)
+{
+    struct hash_t *entry;
+    int i;
+
+    if ((entry = gethash(name)) == NULL) {
+        for (i = 0; i < MAXHASH; i++)
+            if (hashes[i].name[0] == '\0')
+                break;
+        if (i == MAXHASH) {
+            i = nexthash;
+            nexthash = (nexthash + 1) % MAXHASH;
+        }
+        entry = &hashes[i];
+        snprintf(entry->name, MAXLINE, "%s", name);
+    }
+    snprintf(entry->path, MAXLINE, "%s", path);
+    entry->hits = 0;
+    if (verbose)
+        printf("Hashed %s -> %s\n", entry->name, entry->path);
+    return entry;
+}
+
+/* clearhash - Forget every remembered command path */
+void clearhash(void)
+{
+    int i;
+    for (i = 0; i < MAXHASH; i++) {
+	hashes[i].name[0] = '\0';
+	hashes[i].path[0] = '\0';
+	hashes[i].hits = 0;
+    }
+    nexthash = 0;
+}
+
+/* check_hash_path - Empty the hash table if PATH changed since it was filled */
+void check_hash_path(void)
+{
+    const char *path = getenv("PATH");
+    if (path == NULL)
+        path = DEFPATH;
+    if (hashed_path == NULL || strcmp(path, hashed_path) != 0) {
+        clearhash();
+        free(hashed_path);
+        if ((hashed_path = strdup(path)) == NULL)
+            handle_error(ERR_UNIX, "strdup error");
+    }
+}
+
+/* listhash - Print the hash table */
+void listhash(void)
+{
+    int i, header = 0;
+    for (i = 0; i < MAXHASH; i++) {
+	if (hashes[i].name[0] != '\0') {
+	    if (!header++)
+		printf("hits\tcommand\n");
+	    printf("%4d\t%s\n", hashes[i].hits, hashes[i].path);
+	}
+    }
+    if (!header)
+        printf("hash: hash table empty\n");
+}
+/****************************
+ * end hash table routines
+ ****************************/
+
+
 /***********************
  * Other helper routines
  ***********************/
@@ -608,10 +2126,13 @@ void listjobs(struct job_t *jobs)
  
 void usage(void)
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvpf] [-o k] [-j n [file]]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -f   launch commands with fork instead of posix_spawn\n");
+    printf("   -j n run the commands in [file] or stdin as a batch, n at a time\n");
+    printf("   -o k capture background job output in k-kilobyte ring buffers\n");
     exit(1);
 }
 
@@ -634,6 +2155,15 @@ void handle_error(ErrorType err, const char *msg) {
         case ERR_NO_CMD:
             fprintf(stderr, "%s: Command not found\n", msg);
             break;
+        case ERR_SYNTAX:
+            fprintf(stderr, "syntax error near unexpected token '%s'\n", msg);
+            break;
+        case ERR_BAD_ARG:
+            fprintf(stderr, "%s: invalid argument\n", msg);
+            break;
+        case ERR_FILE:
+            fprintf(stderr, "%s: %s\n", msg, strerror(errno)); // Like ERR_UNIX but not fatal
+            break;
         case ERR_UNIX:
             fprintf(stderr, "%s: %s\n", msg, strerror(errno)); // Print the system error message
             exit(1);
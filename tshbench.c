@@ -0,0 +1,382 @@
+/*
+ * tshbench - Latency benchmark harness for tsh
+ *
+ * Runs tsh -p with its stdin and stdout on pipes and measures:
+ *
+ *   builtin   line in to shell ready again for a builtin (the baseline)
+ *   launch    line in to shell ready again for a trivial external command
+ *   fgdone    foreground child exit to shell ready again (waitfg/reaping)
+ *   ctrl-z    SIGTSTP to the shell until "stopped by signal" is printed
+ *   ctrl-c    SIGINT to the shell until "terminated by signal" is printed
+ *   bg        throughput of many concurrent background jobs
+ *
+ * "Ready again" is detected by sending the builtin fg without arguments
+ * behind the command being measured: tsh answers it with an error line
+ * without forking, as soon as it gets back to reading input. The fgdone
+ * and signal tests run this program itself as the child (-X and -S) so
+ * the child can report when it exits, starts and continues.
+ *
+ * Usage: tshbench [-n iterations] [-b jobs] [-t tsh] [-- tsh options]
+ */
+
+/**************
+*Dillon Gaughan
+**************/
+
+#define _GNU_SOURCE            // PATH_MAX, getopt, realpath and clock_gettime under -std=c99
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAXLINE 1024
+#define TIMEOUT 10.0                /* seconds to wait for any reply */
+#define MARKER "fg command requires" /* tsh reply to a bare fg */
+#define MAXJOBS 16                  /* size of the tsh job table */
+
+/***** Global Variables *****/
+
+pid_t tsh_pid;                     /* the shell under test */
+int to_tsh, from_tsh;              /* its stdin and stdout */
+char inbuf[1 << 16];               /* unread output of the shell */
+int inlen = 0;
+char self[PATH_MAX];               /* this program, run as the child */
+
+/***** Function Headers *****/
+
+double now_usec(void);
+void start_tsh(char *tsh, char **args);
+void send_line(const char *fmt, ...);
+double wait_for(const char *needle, char *line);
+void report(const char *name, double *samples, int n);
+int compare_double(const double *a, const double *b);
+void bench_builtin(int iters);
+void bench_launch(int iters);
+void bench_fgdone(int iters);
+void bench_signals(int iters);
+void bench_bg(int jobs);
+void child_exit(void);
+void sigcont_handler(int sig);
+void child_stop(void);
+void usage(char *name);
+
+/******************
+*Main program start
+******************/
+
+int main(int argc, char **argv)
+{
+    char *tsh = "./tsh";
+    int iters = 200, bgjobs = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hn:b:t:XS")) != -1) {
+        switch (opt) {
+        case 'n':
+            iters = atoi(optarg);
+            break;
+        case 'b':
+            bgjobs = atoi(optarg);
+            break;
+        case 't':
+            tsh = optarg;
+            break;
+        case 'X':
+            child_exit();
+            break;
+        case 'S':
+            child_stop();
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (iters <= 0 || bgjobs <= 0)
+        usage(argv[0]);
+    if (!realpath("/proc/self/exe", self)) {
+        perror("realpath");
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    start_tsh(tsh, &argv[optind]);
+    printf("%-8s %6s %9s %9s %9s %9s %9s   (microseconds)\n", "test", "n", "min", "p50", "p90", "p99", "max");
+    bench_builtin(iters);
+    bench_launch(iters);
+    bench_fgdone(iters);
+    bench_signals(iters);
+    bench_bg(bgjobs);
+
+    send_line("quit\n");
+    close(to_tsh);
+    waitpid(tsh_pid, NULL, 0);
+    return 0;
+}
+
+/***** Monotonic clock in microseconds, the same clock in every process *****/
+
+double now_usec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/***** Run tsh -p [args] on a pair of pipes *****/
+
+void start_tsh(char *tsh, char **args) {
+    char *argv[64] = {tsh, "-p"};
+    int in[2], out[2], i;
+
+    for (i = 0; args[i] && i < 61; i++)
+        argv[i + 2] = args[i];
+    argv[i + 2] = NULL;
+    if (pipe(in) < 0 || pipe(out) < 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    if ((tsh_pid = fork()) == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+        execv(tsh, argv);
+        perror(tsh);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+    to_tsh = in[1];
+    from_tsh = out[0];
+}
+
+/***** Write one command line to the shell *****/
+
+void send_line(const char *fmt, ...) {
+    char line[MAXLINE];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (write(to_tsh, line, len) != len) {
+        fprintf(stderr, "tshbench: shell went away\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/***** Read shell output until a line containing needle arrives. Returns
+the arrival time and copies the line if asked, exits on timeout. *****/
+
+double wait_for(const char *needle, char *line) {
+    struct pollfd pfd = {from_tsh, POLLIN, 0};
+    double deadline = now_usec() + TIMEOUT * 1e6;
+    char *nl;
+    int n, len;
+
+    while (1) {
+        while ((nl = memchr(inbuf, '\n', inlen)) != NULL) {
+            len = nl - inbuf + 1;
+            *nl = '\0';
+            int found = strstr(inbuf, needle) != NULL;
+            if (found && line)
+                strcpy(line, inbuf);
+            memmove(inbuf, inbuf + len, inlen - len);
+            inlen -= len;
+            if (found)
+                return now_usec();
+        }
+        if (now_usec() > deadline || poll(&pfd, 1, 100) < 0) {
+            fprintf(stderr, "tshbench: timed out waiting for \"%s\"\n", needle);
+            kill(tsh_pid, SIGKILL);
+            exit(EXIT_FAILURE);
+        }
+        if (pfd.revents && (n = read(from_tsh, inbuf + inlen, sizeof(inbuf) - 1 - inlen)) > 0)
+            inlen += n;
+        else if (pfd.revents) {
+            fprintf(stderr, "tshbench: shell exited waiting for \"%s\"\n", needle);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/***** Print min, percentiles and max of a set of samples *****/
+
+void report(const char *name, double *samples, int n) {
+    qsort(samples, n, sizeof(double), (int (*)(const void *, const void *))compare_double);
+    printf("%-8s %6d %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, n, samples[0],
+           samples[(n - 1) / 2], samples[(int)((n - 1) * 0.9)], samples[(int)((n - 1) * 0.99)], samples[n - 1]);
+    fflush(stdout);
+}
+
+int compare_double(const double *a, const double *b) {
+    return (*a > *b) - (*a < *b);
+}
+
+/***************
+ * Benchmarks
+ ***************/
+
+/***** Round trip of a builtin, the floor under every other number *****/
+
+void bench_builtin(int iters) {
+    double *t = malloc(iters * sizeof(double)), start;
+    int i;
+    for (i = 0; i < iters; i++) {
+        start = now_usec();
+        send_line("fg\n");
+        t[i] = wait_for(MARKER, NULL) - start;
+    }
+    report("builtin", t, iters);
+    free(t);
+}
+
+/***** Trivial command: launch, exec, exit, reap and back to reading *****/
+
+void bench_launch(int iters) {
+    double *t = malloc(iters * sizeof(double)), start;
+    int i;
+    for (i = 0; i < iters; i++) {
+        start = now_usec();
+        send_line("/bin/true\nfg\n");
+        t[i] = wait_for(MARKER, NULL) - start;
+    }
+    report("launch", t, iters);
+    free(t);
+}
+
+/***** Foreground completion: the child prints its exit time, the shell
+has to notice the exit and return from waitfg *****/
+
+void bench_fgdone(int iters) {
+    double *t = malloc(iters * sizeof(double)), exited;
+    char line[MAXLINE];
+    int i;
+    for (i = 0; i < iters; i++) {
+        send_line("%s -X\nfg\n", self);
+        wait_for("exit ", line);
+        exited = atof(line + 5);
+        t[i] = wait_for(MARKER, NULL) - exited;
+    }
+    report("fgdone", t, iters);
+    free(t);
+}
+
+/***** ctrl-z then ctrl-c on a foreground job, as the terminal would send
+them to the shell. The child says when it is running again so the signal
+is never sent while the shell has no foreground job. *****/
+
+void bench_signals(int iters) {
+    double *tz = malloc(iters * sizeof(double));
+    double *tc = malloc(iters * sizeof(double)), start;
+    char line[MAXLINE];
+    int i, jid;
+    for (i = 0; i < iters; i++) {
+        send_line("%s -S\n", self);
+        wait_for("child ready", NULL);
+        start = now_usec();
+        kill(tsh_pid, SIGTSTP);
+        tz[i] = wait_for("stopped by signal", line) - start;
+        if (sscanf(line, "Job [%d]", &jid) != 1)
+            jid = 1;
+        send_line("fg %%%d\n", jid);
+        wait_for("child continued", NULL);
+        start = now_usec();
+        kill(tsh_pid, SIGINT);
+        tc[i] = wait_for("terminated by signal", NULL) - start;
+    }
+    report("ctrl-z", tz, iters);
+    report("ctrl-c", tc, iters);
+    free(tz);
+    free(tc);
+}
+
+/***** Many background jobs: time to launch them all and time until the
+job list is empty again. At most MAXJOBS are in flight, a wave is sent
+when jobs shows there is room for it, so the test measures launches and
+not the shell refusing jobs while its table is full. *****/
+
+void bench_bg(int jobs) {
+    char line[MAXLINE];
+    double start, launched, drained;
+    int i, n, sent = 0, inflight = 0, full = 0;
+
+    start = now_usec();
+    while (sent < jobs) {
+        n = MAXJOBS - inflight;
+        if (n > jobs - sent)
+            n = jobs - sent;
+        for (i = 0; i < n; i++)
+            send_line("/bin/true &\n");
+        sent += n;
+        send_line("jobs\nfg\n");
+        inflight = 0;
+        while (1) {                  //count the jobs still running
+            wait_for("", line);
+            if (strstr(line, "too many jobs"))
+                full++;
+            else if (strstr(line, "Running"))
+                inflight++;
+            else if (strstr(line, MARKER))
+                break;
+        }
+    }
+    launched = now_usec();
+    do {                             //poll until every job has been reaped
+        send_line("jobs\nfg\n");
+        wait_for("", line);
+        if (!strstr(line, MARKER))
+            wait_for(MARKER, NULL);
+    } while (!strstr(line, MARKER));
+    drained = now_usec();
+
+    printf("bg       %6d jobs launched in %.1f ms (%.0f jobs/s), all reaped after %.1f ms, %d refused (job table full)\n",
+           jobs, (launched - start) / 1e3, jobs / ((launched - start) / 1e6), (drained - start) / 1e3, full);
+}
+
+/*******************************
+ * Child modes, run by the shell
+ *******************************/
+
+/***** -X: report the exit time and exit *****/
+
+void child_exit(void) {
+    printf("exit %.3f\n", now_usec());
+    fflush(stdout);
+    exit(0);
+}
+
+/***** -S: say when running and when continued, wait for signals *****/
+
+void sigcont_handler(int sig) {
+    static const char msg[] = "child continued\n";
+    (void)sig;
+    if (write(STDOUT_FILENO, msg, sizeof(msg) - 1) < 0)
+        _exit(1);
+}
+
+void child_stop(void) {
+    signal(SIGCONT, sigcont_handler);
+    printf("child ready\n");
+    fflush(stdout);
+    while (1)
+        pause();
+}
+
+/*
+ * usage - print a help message
+ */
+
+void usage(char *name) {
+    printf("Usage: %s [-n iterations] [-b jobs] [-t tsh] [-- tsh options]\n", name);
+    printf("   -n   samples per latency test (default 200)\n");
+    printf("   -b   background jobs for the throughput test (default 1000)\n");
+    printf("   -t   shell to test (default ./tsh)\n");
+    exit(1);
+}